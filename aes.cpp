@@ -0,0 +1,381 @@
+#include "aes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AESNI
+#include <cpuid.h>
+#include <immintrin.h>
+#define AESNI_TARGET __attribute__((target("aes,ssse3")))
+#endif
+
+
+// S-box and the round tables combining SubBytes, ShiftRows and MixColumns,
+// computed on first use.
+struct AesTables {
+  AesTables();
+
+  uint8_t sbox[256];
+  uint32_t te[4][256];
+};
+
+static uint8_t rotateLeft8(uint8_t x, int shift) {
+	return (x << shift) | (x >> (8 - shift));
+}
+
+static uint32_t rotateRight32(uint32_t x, int shift) {
+	return (x >> shift) | (x << (32 - shift));
+}
+
+static uint8_t mul2(uint8_t x) {
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+AesTables::AesTables() {
+	// p walks through all non-zero elements as powers of 3, q = 1 / p
+	uint8_t p = 1;
+	uint8_t q = 1;
+	do {
+		p = p ^ mul2(p);
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if (q & 0x80) {
+			q ^= 0x09;
+		}
+		sbox[p] = q ^ rotateLeft8(q, 1) ^ rotateLeft8(q, 2) ^ rotateLeft8(q, 3) ^ rotateLeft8(q, 4) ^ 0x63;
+	} while (p != 1);
+	sbox[0] = 0x63;
+
+	for (int i = 0; i < 256; i++) {
+		uint8_t s = sbox[i];
+		te[0][i] = (mul2(s) << 24) | (s << 16) | (s << 8) | (uint8_t)(mul2(s) ^ s);
+		for (int j = 1; j < 4; j++) {
+			te[j][i] = rotateRight32(te[0][i], 8 * j);
+		}
+	}
+}
+
+static const AesTables& getTables() {
+	static const AesTables tables;
+	return tables;
+}
+
+
+static void xorBytes(const uint8_t *a, const uint8_t *b, uint8_t *out, uint64_t length) {
+	uint64_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		memcpy(out + i, &x, 8);
+	}
+	for (; i < length; i++) {
+		out[i] = a[i] ^ b[i];
+	}
+}
+
+
+#ifdef HAVE_AESNI
+
+// Blocks in flight at once, enough to hide the latency of AESENC
+static const uint32_t AESNI_BLOCKS = 8;
+
+static AESNI_TARGET inline __m128i aesniEncrypt(__m128i block, const __m128i *rk) {
+	block = _mm_xor_si128(block, rk[0]);
+	for (uint32_t r = 1; r < Aes256::ROUNDS; r++) {
+		block = _mm_aesenc_si128(block, rk[r]);
+	}
+	return _mm_aesenclast_si128(block, rk[Aes256::ROUNDS]);
+}
+
+static AESNI_TARGET inline void aesniEncryptBlocks(__m128i *blocks, const __m128i *rk) {
+	for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+		blocks[j] = _mm_xor_si128(blocks[j], rk[0]);
+	}
+	for (uint32_t r = 1; r < Aes256::ROUNDS; r++) {
+		for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+			blocks[j] = _mm_aesenc_si128(blocks[j], rk[r]);
+		}
+	}
+	for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+		blocks[j] = _mm_aesenclast_si128(blocks[j], rk[Aes256::ROUNDS]);
+	}
+}
+
+static AESNI_TARGET void aesniLoadKeys(const uint8_t *roundKeyBytes, __m128i *rk) {
+	for (uint32_t r = 0; r <= Aes256::ROUNDS; r++) {
+		rk[r] = _mm_loadu_si128((const __m128i *)(roundKeyBytes + r * Aes256::BLOCK_SIZE));
+	}
+}
+
+static AESNI_TARGET void aesniEncryptBlock(const uint8_t *roundKeyBytes, const uint8_t *in, uint8_t *out) {
+	__m128i rk[Aes256::ROUNDS + 1];
+	aesniLoadKeys(roundKeyBytes, rk);
+	_mm_storeu_si128((__m128i *)out, aesniEncrypt(_mm_loadu_si128((const __m128i *)in), rk));
+}
+
+static AESNI_TARGET void aesniCtr(const uint8_t *roundKeyBytes, const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) {
+	__m128i rk[Aes256::ROUNDS + 1];
+	aesniLoadKeys(roundKeyBytes, rk);
+	// The counter is kept as a little endian 128-bit number, the low half
+	// in the low lane, and byte swapped into each block
+	const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i counter = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)iv), swap);
+	const __m128i one = _mm_set_epi64x(0, 1);
+	uint64_t low = ((uint64_t)READ_BE_UINT32(iv + 8) << 32) | READ_BE_UINT32(iv + 12);
+	__m128i blocks[AESNI_BLOCKS];
+	while (length > 0) {
+		for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+			blocks[j] = _mm_shuffle_epi8(counter, swap);
+			counter = _mm_add_epi64(counter, one);
+			if (++low == 0) {
+				// Carry into the high half
+				counter = _mm_add_epi64(counter, _mm_set_epi64x(1, 0));
+			}
+		}
+		aesniEncryptBlocks(blocks, rk);
+		if (length >= AESNI_BLOCKS * Aes256::BLOCK_SIZE) {
+			for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+				__m128i data = _mm_loadu_si128((const __m128i *)(in + j * Aes256::BLOCK_SIZE));
+				_mm_storeu_si128((__m128i *)(out + j * Aes256::BLOCK_SIZE), _mm_xor_si128(data, blocks[j]));
+			}
+			in += AESNI_BLOCKS * Aes256::BLOCK_SIZE;
+			out += AESNI_BLOCKS * Aes256::BLOCK_SIZE;
+			length -= AESNI_BLOCKS * Aes256::BLOCK_SIZE;
+		} else {
+			// The tail, the unused counters are dropped
+			uint8_t keystream[AESNI_BLOCKS * Aes256::BLOCK_SIZE];
+			memcpy(keystream, blocks, sizeof(keystream));
+			xorBytes(in, keystream, out, length);
+			length = 0;
+		}
+	}
+}
+
+static AESNI_TARGET void aesniCfbDecrypt(const uint8_t *roundKeyBytes, const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) {
+	__m128i rk[Aes256::ROUNDS + 1];
+	aesniLoadKeys(roundKeyBytes, rk);
+	// Every keystream block is the encryption of the previous ciphertext
+	// block, which is all known up front
+	__m128i previous = _mm_loadu_si128((const __m128i *)iv);
+	__m128i blocks[AESNI_BLOCKS];
+	__m128i cipher[AESNI_BLOCKS];
+	while (length >= AESNI_BLOCKS * Aes256::BLOCK_SIZE) {
+		for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+			cipher[j] = _mm_loadu_si128((const __m128i *)(in + j * Aes256::BLOCK_SIZE));
+			blocks[j] = (j == 0) ? previous : cipher[j - 1];
+		}
+		previous = cipher[AESNI_BLOCKS - 1];
+		aesniEncryptBlocks(blocks, rk);
+		for (uint32_t j = 0; j < AESNI_BLOCKS; j++) {
+			_mm_storeu_si128((__m128i *)(out + j * Aes256::BLOCK_SIZE), _mm_xor_si128(cipher[j], blocks[j]));
+		}
+		in += AESNI_BLOCKS * Aes256::BLOCK_SIZE;
+		out += AESNI_BLOCKS * Aes256::BLOCK_SIZE;
+		length -= AESNI_BLOCKS * Aes256::BLOCK_SIZE;
+	}
+	while (length > 0) {
+		uint8_t keystream[Aes256::BLOCK_SIZE];
+		_mm_storeu_si128((__m128i *)keystream, aesniEncrypt(previous, rk));
+		uint64_t size = (length < Aes256::BLOCK_SIZE) ? length : Aes256::BLOCK_SIZE;
+		if (size == Aes256::BLOCK_SIZE) {
+			previous = _mm_loadu_si128((const __m128i *)in);
+		}
+		xorBytes(in, keystream, out, size);
+		in += size;
+		out += size;
+		length -= size;
+	}
+}
+
+#endif // HAVE_AESNI
+
+
+bool Aes256::hasAesni() {
+#ifdef HAVE_AESNI
+	static const bool aesni = []() {
+		unsigned int eax, ebx, ecx, edx;
+		return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) != 0 && (ecx & bit_SSSE3) != 0;
+	}();
+	return aesni;
+#else
+	return false;
+#endif
+}
+
+const char *Aes256::getBackendName(Backend backend) {
+	switch (backend) {
+		case BACKEND_AESNI:
+			return "aes-ni";
+		case BACKEND_PORTABLE:
+			return "portable";
+		default:
+			return "auto";
+	}
+}
+
+
+static uint32_t subWord(const uint8_t *sbox, uint32_t w) {
+	return (sbox[w >> 24] << 24) | (sbox[(w >> 16) & 0xff] << 16) | (sbox[(w >> 8) & 0xff] << 8) | sbox[w & 0xff];
+}
+
+Aes256::Aes256(const uint8_t *key, Backend backend) {
+	const uint8_t *sbox = getTables().sbox;
+	const uint32_t keyWords = KEY_SIZE / 4;
+	uint32_t schedule[SCHEDULE_WORDS];
+	for (uint32_t i = 0; i < keyWords; i++) {
+		schedule[i] = READ_BE_UINT32(key + 4 * i);
+	}
+	uint8_t rcon = 1;
+	for (uint32_t i = keyWords; i < SCHEDULE_WORDS; i++) {
+		uint32_t w = schedule[i - 1];
+		if (i % keyWords == 0) {
+			w = subWord(sbox, rotateRight32(w, 24)) ^ (rcon << 24);
+			rcon = mul2(rcon);
+		} else if (i % keyWords == 4) {
+			w = subWord(sbox, w);
+		}
+		schedule[i] = schedule[i - keyWords] ^ w;
+	}
+	setSchedule(schedule, backend);
+}
+
+Aes256::Aes256(const uint32_t *schedule, Backend backend) {
+	setSchedule(schedule, backend);
+}
+
+
+void Aes256::setSchedule(const uint32_t *schedule, Backend backend) {
+	for (uint32_t i = 0; i < SCHEDULE_WORDS; i++) {
+		m_roundKeys[i] = schedule[i];
+		WRITE_BE_UINT32(m_roundKeyBytes + 4 * i, schedule[i]);
+	}
+	if (backend == BACKEND_AUTO || backend == BACKEND_AESNI) {
+		m_backend = hasAesni() ? BACKEND_AESNI : BACKEND_PORTABLE;
+	} else {
+		m_backend = BACKEND_PORTABLE;
+	}
+}
+
+
+void Aes256::encryptBlock(const uint8_t *in, uint8_t *out) const {
+#ifdef HAVE_AESNI
+	if (m_backend == BACKEND_AESNI) {
+		aesniEncryptBlock(m_roundKeyBytes, in, out);
+		return;
+	}
+#endif
+	const AesTables& tables = getTables();
+	const uint32_t *rk = m_roundKeys;
+	uint32_t s0 = READ_BE_UINT32(in) ^ rk[0];
+	uint32_t s1 = READ_BE_UINT32(in + 4) ^ rk[1];
+	uint32_t s2 = READ_BE_UINT32(in + 8) ^ rk[2];
+	uint32_t s3 = READ_BE_UINT32(in + 12) ^ rk[3];
+	for (uint32_t r = 1; r < ROUNDS; r++) {
+		rk += 4;
+		uint32_t t0 = tables.te[0][s0 >> 24] ^ tables.te[1][(s1 >> 16) & 0xff] ^ tables.te[2][(s2 >> 8) & 0xff] ^ tables.te[3][s3 & 0xff] ^ rk[0];
+		uint32_t t1 = tables.te[0][s1 >> 24] ^ tables.te[1][(s2 >> 16) & 0xff] ^ tables.te[2][(s3 >> 8) & 0xff] ^ tables.te[3][s0 & 0xff] ^ rk[1];
+		uint32_t t2 = tables.te[0][s2 >> 24] ^ tables.te[1][(s3 >> 16) & 0xff] ^ tables.te[2][(s0 >> 8) & 0xff] ^ tables.te[3][s1 & 0xff] ^ rk[2];
+		uint32_t t3 = tables.te[0][s3 >> 24] ^ tables.te[1][(s0 >> 16) & 0xff] ^ tables.te[2][(s1 >> 8) & 0xff] ^ tables.te[3][s2 & 0xff] ^ rk[3];
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+	// The last round has no MixColumns
+	rk += 4;
+	const uint8_t *sbox = tables.sbox;
+	WRITE_BE_UINT32(out, ((sbox[s0 >> 24] << 24) | (sbox[(s1 >> 16) & 0xff] << 16) | (sbox[(s2 >> 8) & 0xff] << 8) | sbox[s3 & 0xff]) ^ rk[0]);
+	WRITE_BE_UINT32(out + 4, ((sbox[s1 >> 24] << 24) | (sbox[(s2 >> 16) & 0xff] << 16) | (sbox[(s3 >> 8) & 0xff] << 8) | sbox[s0 & 0xff]) ^ rk[1]);
+	WRITE_BE_UINT32(out + 8, ((sbox[s2 >> 24] << 24) | (sbox[(s3 >> 16) & 0xff] << 16) | (sbox[(s0 >> 8) & 0xff] << 8) | sbox[s1 & 0xff]) ^ rk[2]);
+	WRITE_BE_UINT32(out + 12, ((sbox[s3 >> 24] << 24) | (sbox[(s0 >> 16) & 0xff] << 16) | (sbox[(s1 >> 8) & 0xff] << 8) | sbox[s2 & 0xff]) ^ rk[3]);
+}
+
+
+void Aes256::addToCounter(uint8_t *counter, uint64_t blocks) {
+	for (int i = BLOCK_SIZE - 1; i >= 0 && blocks != 0; i--) {
+		blocks += counter[i];
+		counter[i] = blocks & 0xff;
+		blocks >>= 8;
+	}
+}
+
+
+void Aes256::ctr(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const {
+#ifdef HAVE_AESNI
+	if (m_backend == BACKEND_AESNI) {
+		aesniCtr(m_roundKeyBytes, iv, in, out, length);
+		return;
+	}
+#endif
+	ctrPortable(iv, in, out, length);
+}
+
+void Aes256::ctrPortable(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const {
+	uint8_t counter[BLOCK_SIZE];
+	memcpy(counter, iv, BLOCK_SIZE);
+	uint8_t keystream[KEYSTREAM_BLOCKS * BLOCK_SIZE];
+	while (length > 0) {
+		uint64_t blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		if (blocks > KEYSTREAM_BLOCKS) {
+			blocks = KEYSTREAM_BLOCKS;
+		}
+		for (uint64_t i = 0; i < blocks; i++) {
+			encryptBlock(counter, keystream + i * BLOCK_SIZE);
+			addToCounter(counter, 1);
+		}
+		uint64_t size = blocks * BLOCK_SIZE;
+		if (size > length) {
+			size = length;
+		}
+		xorBytes(in, keystream, out, size);
+		in += size;
+		out += size;
+		length -= size;
+	}
+}
+
+
+void Aes256::cfbEncrypt(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const {
+	// Each block needs the previous ciphertext, so this is one at a time
+	uint8_t keystream[BLOCK_SIZE];
+	const uint8_t *previous = iv;
+	while (length > 0) {
+		encryptBlock(previous, keystream);
+		uint64_t size = (length < BLOCK_SIZE) ? length : BLOCK_SIZE;
+		xorBytes(in, keystream, out, size);
+		previous = out;
+		in += size;
+		out += size;
+		length -= size;
+	}
+}
+
+
+void Aes256::cfbDecrypt(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const {
+#ifdef HAVE_AESNI
+	if (m_backend == BACKEND_AESNI) {
+		aesniCfbDecrypt(m_roundKeyBytes, iv, in, out, length);
+		return;
+	}
+#endif
+	cfbDecryptPortable(iv, in, out, length);
+}
+
+void Aes256::cfbDecryptPortable(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const {
+	uint8_t keystream[BLOCK_SIZE];
+	uint8_t previous[BLOCK_SIZE];
+	memcpy(previous, iv, BLOCK_SIZE);
+	while (length > 0) {
+		encryptBlock(previous, keystream);
+		uint64_t size = (length < BLOCK_SIZE) ? length : BLOCK_SIZE;
+		if (size == BLOCK_SIZE) {
+			// Kept before out overwrites it when decrypting in place
+			memcpy(previous, in, BLOCK_SIZE);
+		}
+		xorBytes(in, keystream, out, size);
+		in += size;
+		out += size;
+		length -= size;
+	}
+}
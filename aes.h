@@ -0,0 +1,69 @@
+#ifndef AES_H__
+#define AES_H__
+
+#include "sys.h"
+
+
+// AES-256 encryption in the modes used by PSARC archives: CFB with full
+// block feedback for the TOC, and counter mode for .sng files, where the
+// keystream is the encryption of the IV taken as a 128-bit big-endian
+// counter, incremented once per 16-byte block. Only the encryption
+// direction of the cipher is needed for both.
+//
+// The key is expanded once by the constructor, so one Aes256 can process
+// any number of buffers, from several threads. Blocks are encrypted with
+// the AES-NI instructions when the CPU has them, several at a time where
+// the mode allows it, and with lookup tables otherwise.
+class Aes256 {
+public:
+  static const uint32_t BLOCK_SIZE = 16;
+  static const uint32_t KEY_SIZE = 32;
+  static const uint32_t ROUNDS = 14;
+  static const uint32_t SCHEDULE_WORDS = 4 * (ROUNDS + 1);
+
+  enum Backend {
+    BACKEND_AUTO,
+    BACKEND_PORTABLE,
+    BACKEND_AESNI
+  };
+
+  // BACKEND_AUTO picks AES-NI when available, asking for it when it is
+  // not falls back to the portable code.
+  Aes256(const uint8_t *key, Backend backend = BACKEND_AUTO);
+  // Starts from the expanded key, as returned by getSchedule(), for keys
+  // known at compile time.
+  Aes256(const uint32_t *schedule, Backend backend = BACKEND_AUTO);
+
+  const uint32_t *getSchedule() const { return m_roundKeys; }
+  Backend getBackend() const { return m_backend; }
+  static bool hasAesni();
+  static const char *getBackendName(Backend backend);
+
+  // XORs length bytes of in with the keystream starting at counter iv into
+  // out. in and out may be the same buffer.
+  void ctr(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const;
+  // CFB encryption and decryption of length bytes, a partial last block
+  // uses the start of its keystream block. in and out may be the same.
+  void cfbEncrypt(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const;
+  void cfbDecrypt(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const;
+
+  void encryptBlock(const uint8_t *in, uint8_t *out) const;
+
+  // Adds blocks to the big-endian counter.
+  static void addToCounter(uint8_t *counter, uint64_t blocks);
+
+private:
+  // Blocks of keystream generated at a time by the portable code
+  static const uint32_t KEYSTREAM_BLOCKS = 64;
+
+  void setSchedule(const uint32_t *schedule, Backend backend);
+  void ctrPortable(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const;
+  void cfbDecryptPortable(const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const;
+
+  uint32_t m_roundKeys[SCHEDULE_WORDS];
+  // The same round keys in byte order, as loaded by AES-NI
+  uint8_t m_roundKeyBytes[BLOCK_SIZE * (ROUNDS + 1)];
+  Backend m_backend;
+};
+
+#endif // AES_H__
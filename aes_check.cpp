@@ -0,0 +1,128 @@
+#include <chrono>
+#include <vector>
+#include "Rijndael.h"
+#include "aes.h"
+#include "aes_check.h"
+#include "psarc_keys.h"
+
+
+// The keys the schedules in psarc_keys.cpp were expanded from
+static const uint8_t PsarcKey[Aes256::KEY_SIZE] =
+{
+	0xC5, 0x3D, 0xB2, 0x38, 0x70, 0xA1, 0xA2, 0xF7,
+	0x1C, 0xAE, 0x64, 0x06, 0x1F, 0xDD, 0x0E, 0x11,
+	0x57, 0x30, 0x9D, 0xC8, 0x52, 0x04, 0xD4, 0xC5,
+	0xBF, 0xDF, 0x25, 0x09, 0x0D, 0xF2, 0x57, 0x2C
+};
+
+
+static const uint8_t SngKeyMac[Aes256::KEY_SIZE] =
+{
+		0x98, 0x21, 0x33, 0x0E, 0x34, 0xB9, 0x1F, 0x70,
+		0xD0, 0xA4, 0x8C, 0xBD, 0x62, 0x59, 0x93, 0x12,
+		0x69, 0x70, 0xCE, 0xA0, 0x91, 0x92, 0xC0, 0xE6,
+		0xCD, 0xA6, 0x76, 0xCC, 0x98, 0x38, 0x28, 0x9D
+};
+
+
+static const uint8_t SngKeyPC[Aes256::KEY_SIZE] =
+{
+		0xCB, 0x64, 0x8D, 0xF3, 0xD1, 0x2A, 0x16, 0xBF,
+		0x71, 0x70, 0x14, 0x14, 0xE6, 0x96, 0x19, 0xEC,
+		0x17, 0x1C, 0xCA, 0x5D, 0x2A, 0x14, 0x2E, 0x3E,
+		0x59, 0xDE, 0x7A, 0xDD, 0xA1, 0x8A, 0x3A, 0x30
+};
+
+
+static double megabytesPerSecond(uint64_t bytes, std::chrono::steady_clock::time_point start) {
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return (seconds > 0) ? bytes / seconds / (1024 * 1024) : 0;
+}
+
+// Checks every available Aes256 backend bit for bit against CRijndael with
+// the archive keys, in the modes the archives use, and measures them.
+bool checkCipher() {
+	const uint32_t checkSize = 64 * 1024;
+	// Not a whole number of blocks, to cover the tail
+	const uint32_t checkLength = checkSize - 5;
+	const uint64_t benchmarkSize = 64 * 1024 * 1024;
+	const char *keyNames[] = { "PsarcKey", "SngKeyPC", "SngKeyMac" };
+	const uint8_t *keys[] = { PsarcKey, SngKeyPC, SngKeyMac };
+	const uint32_t *schedules[] = { PsarcKeySchedule, SngKeyPCSchedule, SngKeyMacSchedule };
+	// The low half of the counter wraps after a few blocks
+	const uint8_t tocIv[Aes256::BLOCK_SIZE] = { 0 };
+	const uint8_t iv[Aes256::BLOCK_SIZE] = {
+		0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0
+	};
+
+	std::vector<uint8_t> plain(checkSize);
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < checkSize; i++) {
+		seed = seed * 1103515245 + 12345;
+		plain[i] = seed >> 16;
+	}
+
+	std::vector<Aes256::Backend> backends;
+	backends.push_back(Aes256::BACKEND_PORTABLE);
+	if (Aes256::hasAesni()) {
+		backends.push_back(Aes256::BACKEND_AESNI);
+	}
+
+	bool ok = true;
+	std::vector<uint8_t> expected(checkSize);
+	std::vector<uint8_t> out(checkSize);
+	for (uint32_t k = 0; k < 3; k++) {
+		// Counter mode the way .sng files were done with CRijndael, one
+		// single block CFB per counter value
+		std::vector<uint8_t> expectedCtr(checkSize);
+		char counter[Aes256::BLOCK_SIZE];
+		memcpy(counter, iv, Aes256::BLOCK_SIZE);
+		CRijndael rijndael;
+		for (uint32_t offset = 0; offset < checkSize; offset += Aes256::BLOCK_SIZE) {
+			rijndael.MakeKey((const char *)keys[k], counter, Aes256::KEY_SIZE, Aes256::BLOCK_SIZE);
+			rijndael.Encrypt((const char *)&plain[offset], (char *)&expectedCtr[offset], Aes256::BLOCK_SIZE, CRijndael::CFB);
+			Aes256::addToCounter((uint8_t *)counter, 1);
+		}
+		// CFB the way the TOC is encrypted
+		std::vector<uint8_t> expectedCfb(checkSize);
+		rijndael.MakeKey((const char *)keys[k], CRijndael::sm_chain0, Aes256::KEY_SIZE, Aes256::BLOCK_SIZE);
+		rijndael.Encrypt((const char *)&plain[0], (char *)&expectedCfb[0], checkSize, CRijndael::CFB);
+
+		bool scheduleOk = memcmp(Aes256(keys[k]).getSchedule(), schedules[k], Aes256::SCHEDULE_WORDS * sizeof(uint32_t)) == 0;
+		printf("%-9s %-9s schedule %s\n", "", keyNames[k], scheduleOk ? "ok" : "MISMATCH");
+		ok = ok && scheduleOk;
+		for (size_t b = 0; b < backends.size(); b++) {
+			Aes256 aes(schedules[k], backends[b]);
+			const char *backendName = Aes256::getBackendName(aes.getBackend());
+			aes.ctr(iv, &plain[0], &out[0], checkLength);
+			bool ctrOk = memcmp(&out[0], &expectedCtr[0], checkLength) == 0;
+			aes.ctr(iv, &out[0], &out[0], checkLength);
+			ctrOk = ctrOk && memcmp(&out[0], &plain[0], checkLength) == 0;
+			aes.cfbEncrypt(tocIv, &plain[0], &out[0], checkLength);
+			bool cfbOk = memcmp(&out[0], &expectedCfb[0], checkLength) == 0;
+			aes.cfbDecrypt(tocIv, &out[0], &out[0], checkLength);
+			cfbOk = cfbOk && memcmp(&out[0], &plain[0], checkLength) == 0;
+			printf("%-9s %-9s ctr %s, cfb %s\n", backendName, keyNames[k], ctrOk ? "ok" : "MISMATCH", cfbOk ? "ok" : "MISMATCH");
+			ok = ok && ctrOk && cfbOk;
+		}
+	}
+
+	std::vector<uint8_t> data(benchmarkSize);
+	for (size_t b = 0; b < backends.size(); b++) {
+		Aes256 aes(SngKeyPCSchedule, backends[b]);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		aes.ctr(iv, &data[0], &data[0], benchmarkSize);
+		double ctrSpeed = megabytesPerSecond(benchmarkSize, start);
+		start = std::chrono::steady_clock::now();
+		aes.cfbDecrypt(tocIv, &data[0], &data[0], benchmarkSize);
+		double cfbSpeed = megabytesPerSecond(benchmarkSize, start);
+		printf("%-9s ctr %.0f MB/s, cfb decrypt %.0f MB/s\n", Aes256::getBackendName(aes.getBackend()), ctrSpeed, cfbSpeed);
+	}
+	CRijndael rijndael;
+	rijndael.MakeKey((const char *)SngKeyPC, CRijndael::sm_chain0, Aes256::KEY_SIZE, Aes256::BLOCK_SIZE);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	rijndael.Decrypt((const char *)&data[0], (char *)&data[0], benchmarkSize / 4, CRijndael::CFB);
+	printf("%-9s cfb decrypt %.0f MB/s\n", "CRijndael", megabytesPerSecond(benchmarkSize / 4, start));
+	return ok;
+}
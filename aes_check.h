@@ -0,0 +1,9 @@
+#ifndef AES_CHECK_H__
+#define AES_CHECK_H__
+
+
+// Runs --aes-check, returns false on a mismatch. Part of the command line
+// only, librscli does without CRijndael.
+bool checkCipher();
+
+#endif // AES_CHECK_H__
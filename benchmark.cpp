@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include "benchmark.h"
+#include "file.h"
+#include "inflater.h"
+
+
+// Size of the reads, the usual blockSizeAlloc of the archives
+static const uint32_t BlockSize = 64 * 1024;
+// Reads per readBatch(), as many as the io_uring backend keeps in flight
+static const uint32_t BatchSize = 64;
+
+
+static double megabytesPerSecond(uint64_t bytes, std::chrono::steady_clock::time_point start) {
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return (seconds > 0) ? bytes / seconds / (1024 * 1024) : 0;
+}
+
+
+// Drops path from the page cache. Returns the percentage of it still
+// cached afterwards, or -1 when that cannot be done here.
+static int dropFromCache(const char *path, uint64_t size) {
+	int percent = -1;
+#ifdef POSIX_FADV_DONTNEED
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p != MAP_FAILED) {
+		long pageSize = sysconf(_SC_PAGESIZE);
+		std::vector<unsigned char> pages((size + pageSize - 1) / pageSize);
+		if (mincore(p, size, &pages[0]) == 0) {
+			uint64_t cached = 0;
+			for (size_t i = 0; i < pages.size(); i++) {
+				cached += pages[i] & 1;
+			}
+			percent = cached * 100 / pages.size();
+		}
+		munmap(p, size);
+	}
+	::close(fd);
+#endif
+	return percent;
+}
+
+
+// Reads the whole file in BlockSize requests, BatchSize at a time. Returns
+// the speed in MB/s, or a negative value when the file cannot be read.
+static double readFile(const char *path, uint64_t size, FileBackend backend) {
+	// dirname() and basename() may modify their argument
+	std::string dirNamec(path);
+	std::string fileNamec(path);
+	File f;
+	if (!f.open(basename(&fileNamec[0]), dirname(&dirNamec[0]), "rb", backend)) {
+		return -1;
+	}
+	std::vector<uint8_t> buffer(BatchSize * BlockSize);
+	FileReadRequest requests[BatchSize];
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint64_t offset = 0;
+	while (offset < size) {
+		uint32_t count = 0;
+		for (; count < BatchSize && offset < size; count++) {
+			requests[count].offset = offset;
+			requests[count].ptr = &buffer[count * BlockSize];
+			requests[count].size = (size - offset < BlockSize) ? size - offset : BlockSize;
+			offset += requests[count].size;
+		}
+		if (!f.readBatch(requests, count)) {
+			return -1;
+		}
+	}
+	return megabytesPerSecond(size, start);
+}
+
+
+bool benchmarkFile(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		printf("Error: '%s' is not a readable file\n", path);
+		return false;
+	}
+	uint64_t size = st.st_size;
+	printf("Reading %.1f MB in %d KB blocks, %d per batch\n", size / (1024.0 * 1024), BlockSize / 1024, BatchSize);
+
+	const char *names[] = { "stdio", "mmap", "uring" };
+	const FileBackend backends[] = { FILE_BACKEND_STDIO, FILE_BACKEND_MMAP, FILE_BACKEND_URING };
+	int maxCached = 0;
+	for (uint32_t b = 0; b < 3; b++) {
+		int cached = dropFromCache(path, size);
+		double cold = readFile(path, size, backends[b]);
+		double warm = readFile(path, size, backends[b]);
+		if (cold < 0 || warm < 0) {
+			printf("Error: Unable to read '%s'\n", path);
+			return false;
+		}
+		printf("%-9s cold %.0f MB/s, warm %.0f MB/s\n", names[b], cold, warm);
+		maxCached = (cached < 0 || maxCached < 0) ? -1 : std::max(maxCached, cached);
+	}
+	if (maxCached < 0) {
+		printf("Warning: unable to drop the file from the page cache, cold runs were not cold\n");
+	} else if (maxCached > 0) {
+		printf("Warning: up to %d%% of the file stayed in the page cache for the cold runs\n", maxCached);
+	}
+	return true;
+}
+
+
+// Microseconds per block
+static double microsecondsPerBlock(uint64_t blocks, std::chrono::steady_clock::time_point start) {
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return (blocks > 0) ? seconds * 1000000 / blocks : 0;
+}
+
+
+// Compresses data in blockSize blocks and inflates them all rounds times,
+// with uncompress() and with Inflater, checking the output of the first
+// round.
+static bool benchmarkBlocks(const std::vector<uint8_t>& data, uint32_t blockSize, uint32_t rounds) {
+	std::vector<std::vector<uint8_t> > blocks;
+	uint64_t compressedSize = 0;
+	for (size_t offset = 0; offset < data.size(); offset += blockSize) {
+		uLongf length = compressBound(blockSize);
+		std::vector<uint8_t> block(length);
+		compress(&block[0], &length, &data[offset], blockSize);
+		block.resize(length);
+		compressedSize += length;
+		blocks.push_back(block);
+	}
+
+	bool ok = true;
+	std::vector<uint8_t> out(blockSize);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint32_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			uLongf length = blockSize;
+			int ret = uncompress(&out[0], &length, &blocks[i][0], blocks[i].size());
+			if (r == 0) {
+				ok = ok && ret == Z_OK && length == blockSize && memcmp(&out[0], &data[i * blockSize], blockSize) == 0;
+			}
+		}
+	}
+	double before = microsecondsPerBlock((uint64_t)rounds * blocks.size(), start);
+
+	Inflater& inflater = Inflater::forThread();
+	start = std::chrono::steady_clock::now();
+	for (uint32_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			uint64_t length = blockSize;
+			int ret = inflater.inflate(&out[0], &length, &blocks[i][0], blocks[i].size());
+			if (r == 0) {
+				ok = ok && ret == Z_OK && length == blockSize && memcmp(&out[0], &data[i * blockSize], blockSize) == 0;
+			}
+		}
+	}
+	double after = microsecondsPerBlock((uint64_t)rounds * blocks.size(), start);
+
+	printf("%5d byte blocks (%2.0f%% compressed): uncompress() %.2f us, Inflater %.2f us per block (%.2fx)%s\n",
+		blockSize, compressedSize * 100.0 / data.size(), before, after,
+		(after > 0) ? before / after : 0, ok ? "" : ", MISMATCH");
+	return ok;
+}
+
+
+bool benchmarkInflate() {
+	// Text with numbers, compressing about like the XML, JSON and .sng data
+	// of the archives
+	const char *words[] = {
+		"<note time=\"", "\" string=\"", "\" fret=\"", "\" sustain=\"", "\"/>\n",
+		"<chord ", "chordId=\"", "linkNext=\"0\" ", "\"PersistentID\": \"", "\"Arrangement\": \""
+	};
+	const uint32_t dataSize = 4 * 1024 * 1024;
+	std::vector<uint8_t> data;
+	data.reserve(dataSize + 64);
+	uint32_t seed = 1;
+	char number[16];
+	while (data.size() < dataSize) {
+		seed = seed * 1103515245 + 12345;
+		const char *word = words[(seed >> 16) % 10];
+		data.insert(data.end(), word, word + strlen(word));
+		seed = seed * 1103515245 + 12345;
+		snprintf(number, sizeof(number), "%u.%03u", (seed >> 16) % 400, (seed >> 4) % 1000);
+		data.insert(data.end(), number, number + strlen(number));
+	}
+	data.resize(dataSize);
+
+	// Whole blocks of large entries, and small entries of a single block
+	bool ok = benchmarkBlocks(data, 64 * 1024, 16);
+	ok = benchmarkBlocks(data, 4 * 1024, 16) && ok;
+	ok = benchmarkBlocks(data, 512, 4) && ok;
+	return ok;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCHMARK_H__
+#define BENCHMARK_H__
+
+
+// Runs --io-bench: reads path in archive sized blocks with every File
+// backend, with the file dropped from the page cache and again with it
+// cached. Returns false when the file cannot be read.
+bool benchmarkFile(const char *path);
+
+// Runs --inflate-bench: measures the cost per block of uncompress() and of
+// Inflater on generated data. Returns false when they disagree.
+bool benchmarkInflate();
+
+#endif // BENCHMARK_H__
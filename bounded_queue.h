@@ -0,0 +1,60 @@
+#ifndef BOUNDED_QUEUE_H__
+#define BOUNDED_QUEUE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+
+// Blocking FIFO holding at most capacity items, used to connect the stages
+// of a pipeline. push() blocks while the queue is full, pop() blocks while it
+// is empty and returns false once the queue is closed and drained.
+template <typename T>
+class BoundedQueue {
+public:
+  BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {}
+
+  void push(const T& item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this]() { return m_items.size() < m_capacity; });
+    m_items.push_back(item);
+    m_notEmpty.notify_one();
+  }
+
+  void push(T&& item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this]() { return m_items.size() < m_capacity; });
+    m_items.push_back(std::move(item));
+    m_notEmpty.notify_one();
+  }
+
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+    if (m_items.empty()) {
+      return false;
+    }
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  // No more items will be pushed.
+  void close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_notEmpty.notify_all();
+  }
+
+private:
+  size_t m_capacity;
+  bool m_closed;
+  std::deque<T> m_items;
+  std::mutex m_mutex;
+  std::condition_variable m_notFull;
+  std::condition_variable m_notEmpty;
+};
+
+#endif // BOUNDED_QUEUE_H__
@@ -0,0 +1,122 @@
+#include "buffer.h"
+
+
+bool Buffer::allocate(uint64_t capacity) {
+	m_size = 0;
+	if (capacity <= m_capacity && m_data != NULL) {
+		return true;
+	}
+	release();
+	if (m_pool != NULL) {
+		m_data = m_pool->take(capacity, &m_capacity);
+	} else {
+		m_data = (uint8_t *)malloc(capacity > 0 ? capacity : 1);
+		m_capacity = (m_data != NULL) ? capacity : 0;
+	}
+	return m_data != NULL;
+}
+
+void Buffer::release() {
+	if (m_data != NULL) {
+		if (m_pool != NULL) {
+			m_pool->put(m_data, m_capacity);
+		} else {
+			free(m_data);
+		}
+	}
+	m_data = NULL;
+	m_size = 0;
+	m_capacity = 0;
+}
+
+
+// Index of the smallest size class holding capacity bytes, or -1 when it
+// is larger than all of them.
+static int sizeClass(uint64_t capacity) {
+	int index = 0;
+	for (uint64_t classSize = 1ULL << BufferPool::MIN_CLASS_SHIFT; classSize < capacity; classSize <<= 1) {
+		index++;
+	}
+	return (index <= (int)(BufferPool::MAX_CLASS_SHIFT - BufferPool::MIN_CLASS_SHIFT)) ? index : -1;
+}
+
+
+BufferPool::BufferPool() {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+BufferPool::~BufferPool() {
+	trim();
+}
+
+
+Buffer BufferPool::get(uint64_t capacity) {
+	Buffer buffer;
+	buffer.m_pool = this;
+	buffer.allocate(capacity);
+	return buffer;
+}
+
+
+uint8_t *BufferPool::take(uint64_t capacity, uint64_t *classSize) {
+	int index = sizeClass(capacity);
+	*classSize = (index >= 0) ? (1ULL << (MIN_CLASS_SHIFT + index)) : capacity;
+
+	uint8_t *data = NULL;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.allocations++;
+		if (index >= 0 && !m_free[index].empty()) {
+			data = m_free[index].back();
+			m_free[index].pop_back();
+			m_stats.reused++;
+			m_stats.cached -= *classSize;
+		}
+		m_stats.inUse += *classSize;
+		if (m_stats.inUse > m_stats.highWater) {
+			m_stats.highWater = m_stats.inUse;
+		}
+	}
+	if (data == NULL) {
+		data = (uint8_t *)malloc(*classSize > 0 ? *classSize : 1);
+		if (data == NULL) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.inUse -= *classSize;
+			*classSize = 0;
+		}
+	}
+	return data;
+}
+
+
+void BufferPool::put(uint8_t *data, uint64_t capacity) {
+	int index = sizeClass(capacity);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.inUse -= capacity;
+		if (index >= 0 && m_stats.cached + capacity <= MAX_CACHED_BYTES) {
+			m_free[index].push_back(data);
+			m_stats.cached += capacity;
+			return;
+		}
+	}
+	free(data);
+}
+
+
+void BufferPool::trim() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (uint32_t i = 0; i <= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT; i++) {
+		for (size_t j = 0; j < m_free[i].size(); j++) {
+			free(m_free[i][j]);
+		}
+		m_free[i].clear();
+	}
+	m_stats.cached = 0;
+}
+
+
+BufferPoolStats BufferPool::getStats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
@@ -0,0 +1,117 @@
+#ifndef BUFFER_H__
+#define BUFFER_H__
+
+#include <mutex>
+#include <vector>
+#include "sys.h"
+
+class BufferPool;
+
+
+// A block of memory with a size (bytes in use) and a capacity (bytes
+// allocated), taken from a BufferPool or else from malloc. Buffers can be
+// moved but not copied, so there is always exactly one owner to give the
+// memory back.
+class Buffer {
+public:
+  Buffer() : m_data(NULL), m_size(0), m_capacity(0), m_pool(NULL) {}
+  explicit Buffer(uint64_t capacity) : m_data(NULL), m_size(0), m_capacity(0), m_pool(NULL) { allocate(capacity); }
+  ~Buffer() { release(); }
+
+  Buffer(Buffer&& other) noexcept
+    : m_data(other.m_data)
+    , m_size(other.m_size)
+    , m_capacity(other.m_capacity)
+    , m_pool(other.m_pool)
+  {
+    other.m_data = NULL;
+    other.m_size = 0;
+    other.m_capacity = 0;
+  }
+
+  Buffer& operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+      release();
+      m_data = other.m_data;
+      m_size = other.m_size;
+      m_capacity = other.m_capacity;
+      m_pool = other.m_pool;
+      other.m_data = NULL;
+      other.m_size = 0;
+      other.m_capacity = 0;
+    }
+    return *this;
+  }
+
+  // Makes room for capacity bytes, keeping the memory when it is large
+  // enough already. The contents are not preserved and the size is 0.
+  bool allocate(uint64_t capacity);
+  // Gives the memory back to its pool, or frees it.
+  void release();
+
+  uint8_t *data() const { return m_data; }
+  bool isEmpty() const { return m_data == NULL; }
+
+  uint64_t size() const { return m_size; }
+  void setSize(uint64_t size) { m_size = size; }
+
+  uint64_t capacity() const { return m_capacity; }
+
+private:
+  friend class BufferPool;
+
+  Buffer(const Buffer&);
+  Buffer& operator=(const Buffer&);
+
+  uint8_t *m_data;
+  uint64_t m_size;
+  uint64_t m_capacity;
+  BufferPool *m_pool;
+};
+
+
+struct BufferPoolStats {
+  uint64_t allocations;  // buffers handed out
+  uint64_t reused;       // of which came from the free lists
+  uint64_t inUse;        // bytes currently handed out
+  uint64_t highWater;    // most bytes handed out at once
+  uint64_t cached;       // bytes kept in the free lists
+};
+
+
+// Hands out Buffers rounded up to power of two size classes and keeps
+// returned memory on a free list per class, so buffers are recycled
+// across entries (and archives) instead of going back to malloc each
+// time. At most MAX_CACHED_BYTES are kept, larger buffers than the
+// biggest class are not cached at all. Thread safe.
+class BufferPool {
+public:
+  static const uint32_t MIN_CLASS_SHIFT = 12;     // 4KB
+  static const uint32_t MAX_CLASS_SHIFT = 28;     // 256MB
+  static const uint64_t MAX_CACHED_BYTES = 512 * 1024 * 1024;
+
+  BufferPool();
+  ~BufferPool();
+
+  // Returns a buffer of at least capacity bytes, with size 0.
+  Buffer get(uint64_t capacity);
+  // Frees all cached memory.
+  void trim();
+
+  BufferPoolStats getStats();
+
+private:
+  friend class Buffer;
+
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+
+  uint8_t *take(uint64_t capacity, uint64_t *classSize);
+  void put(uint8_t *data, uint64_t capacity);
+
+  std::mutex m_mutex;
+  std::vector<uint8_t *> m_free[MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1];
+  BufferPoolStats m_stats;
+};
+
+#endif // BUFFER_H__
@@ -0,0 +1,296 @@
+#include "codec.h"
+#include "inflater.h"
+
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef HAVE_ZLIB_NG
+#include <zlib-ng.h>
+#endif
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+
+class ZlibCodec : public Codec {
+public:
+	const char *getName() const { return "zlib"; }
+
+	bool decompress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, const char **error) {
+		Inflater& inflater = Inflater::forThread();
+		if (inflater.inflate(dst, dstLength, src, srcLength) != Z_OK) {
+			*error = inflater.getError();
+			return false;
+		}
+		return true;
+	}
+
+	bool compress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, int level) {
+		uLongf length = *dstLength;
+		if (compress2(dst, &length, src, srcLength, level) != Z_OK) {
+			return false;
+		}
+		*dstLength = length;
+		return true;
+	}
+};
+
+
+#ifdef HAVE_LIBDEFLATE
+class LibdeflateCodec : public Codec {
+public:
+	const char *getName() const { return "libdeflate"; }
+
+	bool decompress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, const char **error) {
+		size_t length = 0;
+		enum libdeflate_result ret = libdeflate_zlib_decompress(getDecompressor(), src, srcLength, dst, *dstLength, &length);
+		*dstLength = length;
+		switch (ret) {
+			case LIBDEFLATE_SUCCESS:
+				return true;
+			case LIBDEFLATE_INSUFFICIENT_SPACE:
+				*error = "output buffer too small";
+				return false;
+			default:
+				*error = "truncated or corrupt data";
+				return false;
+		}
+	}
+
+	bool compress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, int level) {
+		struct libdeflate_compressor *compressor = getCompressor(level);
+		if (compressor == NULL) {
+			return false;
+		}
+		size_t length = libdeflate_zlib_compress(compressor, src, srcLength, dst, *dstLength);
+		if (length == 0) {
+			return false;
+		}
+		*dstLength = length;
+		return true;
+	}
+
+private:
+	struct State {
+		struct libdeflate_decompressor *decompressor;
+		struct libdeflate_compressor *compressor;
+		int level;
+		State() : decompressor(NULL), compressor(NULL), level(-1) {}
+		~State() {
+			if (decompressor != NULL)
+				libdeflate_free_decompressor(decompressor);
+			if (compressor != NULL)
+				libdeflate_free_compressor(compressor);
+		}
+	};
+
+	static State& getState() {
+		static thread_local State state;
+		return state;
+	}
+
+	static struct libdeflate_decompressor *getDecompressor() {
+		State& state = getState();
+		if (state.decompressor == NULL)
+			state.decompressor = libdeflate_alloc_decompressor();
+		return state.decompressor;
+	}
+
+	static struct libdeflate_compressor *getCompressor(int level) {
+		State& state = getState();
+		if (state.compressor != NULL && state.level != level) {
+			libdeflate_free_compressor(state.compressor);
+			state.compressor = NULL;
+		}
+		if (state.compressor == NULL) {
+			state.compressor = libdeflate_alloc_compressor(level);
+			state.level = level;
+		}
+		return state.compressor;
+	}
+};
+#endif
+
+
+#ifdef HAVE_ZLIB_NG
+class ZlibNgCodec : public Codec {
+public:
+	const char *getName() const { return "zlib-ng"; }
+
+	bool decompress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, const char **error) {
+		State& state = getState();
+		int ret;
+		if (!state.initialized) {
+			ret = zng_inflateInit(&state.stream);
+			if (ret != Z_OK) {
+				*error = "unable to initialize zlib-ng";
+				*dstLength = 0;
+				return false;
+			}
+			state.initialized = true;
+		} else {
+			zng_inflateReset(&state.stream);
+		}
+		state.stream.next_in = src;
+		state.stream.avail_in = srcLength;
+		state.stream.next_out = dst;
+		state.stream.avail_out = *dstLength;
+		ret = zng_inflate(&state.stream, Z_FINISH);
+		*dstLength = state.stream.total_out;
+		if (ret == Z_STREAM_END) {
+			return true;
+		}
+		*error = (state.stream.msg != NULL) ? state.stream.msg
+			: (state.stream.avail_out == 0) ? "output buffer too small" : "truncated or corrupt data";
+		return false;
+	}
+
+	bool compress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, int level) {
+		size_t length = *dstLength;
+		if (zng_compress2(dst, &length, src, srcLength, level) != Z_OK) {
+			return false;
+		}
+		*dstLength = length;
+		return true;
+	}
+
+private:
+	struct State {
+		zng_stream stream;
+		bool initialized;
+		State() : initialized(false) { memset(&stream, 0, sizeof(stream)); }
+		~State() {
+			if (initialized)
+				zng_inflateEnd(&stream);
+		}
+	};
+
+	static State& getState() {
+		static thread_local State state;
+		return state;
+	}
+};
+#endif
+
+
+#ifdef HAVE_LZMA
+// Blocks of LZMA compressed archives, each one a complete .lzma ("alone")
+// stream with its 13 byte header.
+class LzmaCodec : public Codec {
+public:
+	const char *getName() const { return "lzma"; }
+
+	bool decompress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, const char **error) {
+		lzma_stream& stream = getState().stream;
+		if (lzma_alone_decoder(&stream, UINT64_MAX) != LZMA_OK) {
+			*error = "unable to initialize lzma decoder";
+			*dstLength = 0;
+			return false;
+		}
+		stream.next_in = src;
+		stream.avail_in = srcLength;
+		stream.next_out = dst;
+		stream.avail_out = *dstLength;
+		lzma_ret ret = lzma_code(&stream, LZMA_FINISH);
+		*dstLength = stream.total_out;
+		if (ret == LZMA_STREAM_END) {
+			return true;
+		}
+		switch (ret) {
+			case LZMA_BUF_ERROR:
+				*error = (stream.avail_out == 0) ? "output buffer too small" : "truncated data";
+				break;
+			case LZMA_MEM_ERROR:
+				*error = "out of memory";
+				break;
+			default:
+				*error = "corrupt data";
+				break;
+		}
+		return false;
+	}
+
+	bool compress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, int level) {
+		lzma_options_lzma options;
+		if (lzma_lzma_preset(&options, level)) {
+			return false;
+		}
+		lzma_stream& stream = getState().stream;
+		if (lzma_alone_encoder(&stream, &options) != LZMA_OK) {
+			return false;
+		}
+		stream.next_in = src;
+		stream.avail_in = srcLength;
+		stream.next_out = dst;
+		stream.avail_out = *dstLength;
+		if (lzma_code(&stream, LZMA_FINISH) != LZMA_STREAM_END) {
+			return false;
+		}
+		*dstLength = stream.total_out;
+		return true;
+	}
+
+private:
+	struct State {
+		lzma_stream stream;
+		State() {
+			lzma_stream init = LZMA_STREAM_INIT;
+			stream = init;
+		}
+		~State() {
+			lzma_end(&stream);
+		}
+	};
+
+	static State& getState() {
+		static thread_local State state;
+		return state;
+	}
+};
+#endif
+
+
+Codec *Codec::get(const char *name) {
+	static ZlibCodec zlibCodec;
+	if (strcmp(name, zlibCodec.getName()) == 0) {
+		return &zlibCodec;
+	}
+#ifdef HAVE_LIBDEFLATE
+	static LibdeflateCodec libdeflateCodec;
+	if (strcmp(name, libdeflateCodec.getName()) == 0) {
+		return &libdeflateCodec;
+	}
+#endif
+#ifdef HAVE_ZLIB_NG
+	static ZlibNgCodec zlibNgCodec;
+	if (strcmp(name, zlibNgCodec.getName()) == 0) {
+		return &zlibNgCodec;
+	}
+#endif
+#ifdef HAVE_LZMA
+	static LzmaCodec lzmaCodec;
+	if (strcmp(name, lzmaCodec.getName()) == 0) {
+		return &lzmaCodec;
+	}
+#endif
+	return NULL;
+}
+
+
+Codec *Codec::getZlib(const char *name) {
+	return (strcmp(name, "lzma") != 0) ? get(name) : NULL;
+}
+
+
+const char *Codec::getZlibNames() {
+	return "zlib"
+#ifdef HAVE_LIBDEFLATE
+		" libdeflate"
+#endif
+#ifdef HAVE_ZLIB_NG
+		" zlib-ng"
+#endif
+		;
+}
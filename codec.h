@@ -0,0 +1,35 @@
+#ifndef CODEC_H__
+#define CODEC_H__
+
+#include "sys.h"
+
+
+// Block compression backend. Implementations keep any per-call state per
+// thread, so one Codec may be used from several threads at once.
+class Codec {
+public:
+  virtual ~Codec() {}
+
+  virtual const char *getName() const = 0;
+
+  // Inflates the compressed stream in src into dst. On entry *dstLength is the
+  // size of dst, on return the number of bytes written. On failure returns
+  // false and sets *error to a description.
+  virtual bool decompress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, const char **error) = 0;
+
+  // Deflates src into a compressed stream in dst. On entry *dstLength is the size
+  // of dst, on return the compressed size. Returns false when the result
+  // does not fit.
+  virtual bool compress(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength, int level) = 0;
+
+  // Returns the codec called name, or NULL when it is not built in. "lzma"
+  // is used for LZMA compressed archives, the others for zlib ones.
+  static Codec *get(const char *name);
+  // Returns the codec called name when it reads and writes zlib streams,
+  // the ones --codec chooses from, or NULL.
+  static Codec *getZlib(const char *name);
+  // Space separated names of the built in zlib codecs.
+  static const char *getZlibNames();
+};
+
+#endif // CODEC_H__
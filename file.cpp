@@ -4,6 +4,17 @@
  */
 
 #include "file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
 
 struct File_impl {
 	bool _ioErr;
@@ -16,7 +27,17 @@ struct File_impl {
 	virtual void seek(uint64_t off) = 0;
 	virtual void shift(uint64_t off) = 0;
 	virtual void read(void *ptr, uint32_t size) = 0;
+	virtual bool readAt(uint64_t off, void *ptr, uint32_t size) const = 0;
 	virtual void write(void *ptr, uint32_t size) = 0;
+	virtual const uint8_t *map(uint64_t off, uint64_t size) const { return 0; }
+	virtual bool readBatch(FileReadRequest *requests, uint32_t count) {
+		bool ok = true;
+		for (uint32_t i = 0; i < count; i++) {
+			requests[i].done = readAt(requests[i].offset, requests[i].ptr, requests[i].size);
+			ok = ok && requests[i].done;
+		}
+		return ok;
+	}
 };
 
 struct stdFile : File_impl {
@@ -61,6 +82,24 @@ struct stdFile : File_impl {
 				_ioErr = true;
 		}
 	}
+	bool readAt(uint64_t off, void *ptr, uint32_t size) const {
+		if (!_fp) {
+			return false;
+		}
+		int fd = fileno(_fp);
+		uint8_t *p = (uint8_t *)ptr;
+		while (size > 0) {
+			ssize_t r = pread(fd, p, size, off);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				return false;
+			p += r;
+			off += r;
+			size -= r;
+		}
+		return true;
+	}
 	void write(void *ptr, uint32_t size) {
 		if (_fp) {
 			_offset += size;
@@ -71,6 +110,253 @@ struct stdFile : File_impl {
 	}
 };
 
+struct mmapFile : File_impl {
+	int _fd;
+	uint8_t *_map;
+	uint64_t _size;
+	mmapFile() : _fd(-1), _map(0), _size(0) {}
+	bool open(const char *path, const char *mode) {
+		_ioErr = false;
+		_offset = 0;
+		if (strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+')) {
+			return false;
+		}
+		_fd = ::open(path, O_RDONLY);
+		if (_fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+			close();
+			return false;
+		}
+		void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+		if (p == MAP_FAILED) {
+			close();
+			return false;
+		}
+		_map = (uint8_t *)p;
+		_size = st.st_size;
+		return true;
+	}
+	void close() {
+		if (_map) {
+			munmap(_map, _size);
+			_map = 0;
+			_size = 0;
+		}
+		if (_fd >= 0) {
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+	void seek(uint64_t off) {
+		_offset = off;
+	}
+	void shift(uint64_t off) {
+		_offset += off;
+	}
+	uint64_t offset() {
+		return _offset;
+	}
+	void read(void *ptr, uint32_t size) {
+		if (_map) {
+			uint32_t r = 0;
+			if (_offset < _size) {
+				r = (_size - _offset < size) ? _size - _offset : size;
+				memcpy(ptr, _map + _offset, r);
+			}
+			_offset += size;
+			if (r != size)
+				_ioErr = true;
+		}
+	}
+	bool readAt(uint64_t off, void *ptr, uint32_t size) const {
+		if (_map && off <= _size && size <= _size - off) {
+			memcpy(ptr, _map + off, size);
+			return true;
+		}
+		return false;
+	}
+	void write(void *ptr, uint32_t size) {
+		_ioErr = true;
+	}
+	const uint8_t *map(uint64_t off, uint64_t size) const {
+		if (_map && off <= _size && size <= _size - off) {
+			return _map + off;
+		}
+		return 0;
+	}
+};
+
+#ifdef HAVE_IO_URING
+// stdio file with an io_uring instance on the same descriptor for batched
+// reads. When the ring cannot be set up (old kernel, seccomp, ...), readBatch
+// falls back to synchronous preads.
+struct uringFile : stdFile {
+	enum { QUEUE_DEPTH = 64 };
+
+	int _ringFd;
+	uint8_t *_sqRing;
+	uint8_t *_cqRing;
+	size_t _sqRingSize;
+	size_t _cqRingSize;
+	struct io_uring_sqe *_sqes;
+	size_t _sqesSize;
+	unsigned *_sqHead, *_sqTail, *_sqMask, *_sqArray;
+	unsigned *_cqHead, *_cqTail, *_cqMask;
+	struct io_uring_cqe *_cqes;
+
+	uringFile() : _ringFd(-1), _sqRing(0), _cqRing(0), _sqes(0) {}
+	bool open(const char *path, const char *mode) {
+		if (!stdFile::open(path, mode)) {
+			return false;
+		}
+		if (!strchr(mode, 'w') && !strchr(mode, 'a') && !strchr(mode, '+')) {
+			setupRing();
+		}
+		return true;
+	}
+	void close() {
+		closeRing();
+		stdFile::close();
+	}
+	bool setupRing() {
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		_ringFd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+		if (_ringFd < 0) {
+			return false;
+		}
+		_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			if (_cqRingSize > _sqRingSize)
+				_sqRingSize = _cqRingSize;
+			_cqRingSize = _sqRingSize;
+		}
+		void *sq = mmap(0, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+		if (sq == MAP_FAILED) {
+			closeRing();
+			return false;
+		}
+		_sqRing = (uint8_t *)sq;
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			_cqRing = _sqRing;
+		} else {
+			void *cq = mmap(0, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+			if (cq == MAP_FAILED) {
+				closeRing();
+				return false;
+			}
+			_cqRing = (uint8_t *)cq;
+		}
+		_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+		void *sqes = mmap(0, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			closeRing();
+			return false;
+		}
+		_sqes = (struct io_uring_sqe *)sqes;
+		_sqHead = (unsigned *)(_sqRing + p.sq_off.head);
+		_sqTail = (unsigned *)(_sqRing + p.sq_off.tail);
+		_sqMask = (unsigned *)(_sqRing + p.sq_off.ring_mask);
+		_sqArray = (unsigned *)(_sqRing + p.sq_off.array);
+		_cqHead = (unsigned *)(_cqRing + p.cq_off.head);
+		_cqTail = (unsigned *)(_cqRing + p.cq_off.tail);
+		_cqMask = (unsigned *)(_cqRing + p.cq_off.ring_mask);
+		_cqes = (struct io_uring_cqe *)(_cqRing + p.cq_off.cqes);
+		return true;
+	}
+	void closeRing() {
+		if (_sqes) {
+			munmap(_sqes, _sqesSize);
+			_sqes = 0;
+		}
+		if (_cqRing && _cqRing != _sqRing) {
+			munmap(_cqRing, _cqRingSize);
+		}
+		_cqRing = 0;
+		if (_sqRing) {
+			munmap(_sqRing, _sqRingSize);
+			_sqRing = 0;
+		}
+		if (_ringFd >= 0) {
+			::close(_ringFd);
+			_ringFd = -1;
+		}
+	}
+	bool readBatch(FileReadRequest *requests, uint32_t count) {
+		if (!_sqes) {
+			return File_impl::readBatch(requests, count);
+		}
+		int fd = fileno(_fp);
+		for (uint32_t i = 0; i < count; i++) {
+			requests[i].done = false;
+		}
+		uint32_t submitted = 0;
+		uint32_t pending = 0; // queued in the SQ ring, not consumed by the kernel yet
+		uint32_t inFlight = 0;
+		bool ok = true;
+		while (submitted < count || pending > 0 || inFlight > 0) {
+			unsigned tail = *_sqTail;
+			while (submitted < count && inFlight + pending < QUEUE_DEPTH) {
+				FileReadRequest& request = requests[submitted];
+				unsigned index = tail & *_sqMask;
+				struct io_uring_sqe *sqe = &_sqes[index];
+				memset(sqe, 0, sizeof(*sqe));
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = fd;
+				sqe->addr = (uint64_t)(uintptr_t)request.ptr;
+				sqe->len = request.size;
+				sqe->off = request.offset;
+				sqe->user_data = submitted;
+				_sqArray[index] = index;
+				tail++;
+				submitted++;
+				pending++;
+			}
+			__atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+			int r = syscall(__NR_io_uring_enter, _ringFd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				// Ring is unusable, finish synchronously
+				closeRing();
+				ok = true;
+				for (uint32_t i = 0; i < count; i++) {
+					if (!requests[i].done)
+						requests[i].done = readAt(requests[i].offset, requests[i].ptr, requests[i].size);
+					ok = ok && requests[i].done;
+				}
+				return ok;
+			}
+			pending -= r;
+			inFlight += r;
+			unsigned head = *_cqHead;
+			while (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) {
+				struct io_uring_cqe *cqe = &_cqes[head & *_cqMask];
+				FileReadRequest& request = requests[cqe->user_data];
+				if (cqe->res == (int32_t)request.size) {
+					request.done = true;
+				} else if (cqe->res >= 0) {
+					// Short read, finish the remainder synchronously
+					request.done = readAt(request.offset + cqe->res, (uint8_t *)request.ptr + cqe->res, request.size - cqe->res);
+				} else {
+					// IORING_OP_READ unsupported by the kernel, I/O error, ...
+					request.done = readAt(request.offset, request.ptr, request.size);
+				}
+				ok = ok && request.done;
+				head++;
+				inFlight--;
+			}
+			__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+		}
+		return ok;
+	}
+};
+#endif
+
 File::File() {
 	_impl = new stdFile;
 }
@@ -82,19 +368,34 @@ File::~File() {
 	}
 }
 
-bool File::open(const char *filename, const char *directory, const char *mode) {
+bool File::open(const char *filename, const char *directory, const char *mode, FileBackend backend) {
 	if (_impl) {
 		_impl->close();
 		delete _impl;
 		_impl = 0;
 	}
 
-	if (!_impl)
-		_impl = new stdFile;
-
 	char buf[512];
 	snprintf(buf, sizeof(buf), "%s/%s", directory, filename);
 
+	if (backend == FILE_BACKEND_MMAP) {
+		_impl = new mmapFile;
+		if (_impl->open(buf, mode)) {
+			return true;
+		}
+		// Mapping failed (write mode, empty file, pipe, ...), use stdio instead
+		delete _impl;
+		_impl = 0;
+	}
+
+#ifdef HAVE_IO_URING
+	if (backend == FILE_BACKEND_URING)
+		_impl = new uringFile;
+#endif
+
+	if (!_impl)
+		_impl = new stdFile;
+
 	return _impl->open(buf, mode);
 }
 
@@ -120,10 +421,22 @@ uint64_t File::offset() {
 	return _impl->offset();
 }
 
+const uint8_t *File::map(uint64_t off, uint64_t size) const {
+	return _impl->map(off, size);
+}
+
 void File::read(void *ptr, uint32_t size) {
 	_impl->read(ptr, size);
 }
 
+bool File::readAt(uint64_t off, void *ptr, uint32_t size) const {
+	return _impl->readAt(off, ptr, size);
+}
+
+bool File::readBatch(FileReadRequest *requests, uint32_t count) {
+	return _impl->readBatch(requests, count);
+}
+
 uint8_t File::readByte() {
 	uint8_t b;
 	read(&b, 1);
@@ -10,20 +10,43 @@
 
 struct File_impl;
 
+enum FileBackend {
+	FILE_BACKEND_STDIO = 0,
+	FILE_BACKEND_MMAP,
+	FILE_BACKEND_URING
+};
+
+struct FileReadRequest {
+	uint64_t offset;
+	void *ptr;
+	uint32_t size;
+	bool done;
+};
+
 struct File {
 	File_impl *_impl;
 
 	File();
 	~File();
 
-	bool open(const char *filename, const char *directory, const char *mode="rb");
+	bool open(const char *filename, const char *directory, const char *mode="rb", FileBackend backend=FILE_BACKEND_STDIO);
 	void close();
 	bool ioErr() const;
 	void seek(uint64_t off);
 	void shift(uint64_t off);
 	uint64_t offset();
+	// Returns a pointer to size bytes at off inside the file mapping, or NULL
+	// when the file is not memory-mapped or the range is out of bounds.
+	const uint8_t *map(uint64_t off, uint64_t size) const;
 
 	void read(void *ptr, uint32_t size);
+	// Positional read: does not use or move the file offset and does not set
+	// ioErr, so it may be called concurrently from several threads.
+	bool readAt(uint64_t off, void *ptr, uint32_t size) const;
+	// Reads all requests, in any order, setting done on each one that was
+	// fully read. The io_uring backend keeps them all in flight at once, the
+	// other backends loop over readAt. Returns true when all are done.
+	bool readBatch(FileReadRequest *requests, uint32_t count);
 	uint8_t readByte();
 	uint32_t readInt24BE(uint8_t *ptr);
 	uint64_t readInt40BE(uint8_t *ptr);
@@ -0,0 +1,152 @@
+#include <string>
+#include <unistd.h>
+#include "index_cache.h"
+
+
+IndexCache::IndexCache() : m_header(NULL), m_entries(NULL), m_zBlocks(NULL), m_names(NULL) {
+}
+
+IndexCache::~IndexCache() {
+	close();
+}
+
+
+bool IndexCache::makeKey(const char *arcName, const uint8_t *header, IndexCacheKey *key) {
+	struct stat st;
+	if (stat(arcName, &st) != 0) {
+		return false;
+	}
+	memset(key, 0, sizeof(*key));
+	key->archiveSize = st.st_size;
+#ifdef __APPLE__
+	key->mtimeSec = st.st_mtimespec.tv_sec;
+	key->mtimeNsec = st.st_mtimespec.tv_nsec;
+#else
+	key->mtimeSec = st.st_mtim.tv_sec;
+	key->mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+	memcpy(key->header, header, Header::HEADER_SIZE);
+	return true;
+}
+
+
+static std::string indexPath(const char *arcName) {
+	return std::string(arcName) + ".idx";
+}
+
+static bool openInDirectory(File& file, const std::string& path, const char *mode, FileBackend backend) {
+	char *dirNamec = strdup(path.c_str());
+	char *fileNamec = strdup(path.c_str());
+	bool ok = file.open(basename(fileNamec), dirname(dirNamec), mode, backend);
+	free(dirNamec);
+	free(fileNamec);
+	return ok;
+}
+
+
+bool IndexCache::open(const char *arcName, const IndexCacheKey& key) {
+	close();
+	if (!openInDirectory(m_file, indexPath(arcName), "rb", FILE_BACKEND_MMAP)) {
+		return false;
+	}
+
+	const IndexCacheHeader *header = (const IndexCacheHeader *)m_file.map(0, sizeof(IndexCacheHeader));
+	if (header == NULL || header->magic != MAGIC || header->version != VERSION ||
+		memcmp(&header->key, &key, sizeof(key)) != 0) {
+		close();
+		return false;
+	}
+
+	uint64_t entriesSize = (uint64_t)header->numEntries * sizeof(IndexCacheEntry);
+	uint64_t zBlocksSize = (uint64_t)header->numBlocks * sizeof(uint32_t);
+	uint64_t size = sizeof(IndexCacheHeader) + entriesSize + zBlocksSize + header->namesSize;
+	const uint8_t *data = m_file.map(0, size);
+	if (data == NULL) {
+		close();
+		return false;
+	}
+	m_header = header;
+	m_entries = (const IndexCacheEntry *)(data + sizeof(IndexCacheHeader));
+	m_zBlocks = (const uint32_t *)(data + sizeof(IndexCacheHeader) + entriesSize);
+	m_names = (const char *)(data + sizeof(IndexCacheHeader) + entriesSize + zBlocksSize);
+
+	// Every name has to lie inside the names, NUL terminated
+	if (header->namesSize > 0 && m_names[header->namesSize - 1] != '\0') {
+		close();
+		return false;
+	}
+	for (uint32_t i = 0; i < header->numEntries; i++) {
+		uint32_t nameOffset = m_entries[i].nameOffset;
+		if (nameOffset != Toc::NO_NAME && nameOffset >= header->namesSize) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void IndexCache::close() {
+	m_file.close();
+	m_header = NULL;
+	m_entries = NULL;
+	m_zBlocks = NULL;
+	m_names = NULL;
+}
+
+
+bool IndexCache::write(const char *arcName, const IndexCacheKey& key, const Toc& toc, const std::vector<uint32_t>& zBlocks) {
+	std::vector<IndexCacheEntry> indexEntries(toc.size());
+	for (uint32_t i = 0; i < toc.size(); i++) {
+		IndexCacheEntry& indexEntry = indexEntries[i];
+		memset(&indexEntry, 0, sizeof(indexEntry));
+		memcpy(indexEntry.md5, toc.getMd5(i), sizeof(indexEntry.md5));
+		indexEntry.zIndex = toc.getZIndex(i);
+		indexEntry.nameOffset = toc.getNameOffset(i);
+		indexEntry.length = toc.getLength(i);
+		indexEntry.zOffset = toc.getZOffset(i);
+	}
+	const std::vector<char>& names = toc.getNames();
+
+	IndexCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.key = key;
+	header.numEntries = indexEntries.size();
+	header.numBlocks = zBlocks.size();
+	header.namesSize = names.size();
+
+	// Written under a temporary name first so readers never see half an
+	// index, unique so that concurrent writers do not truncate each other's
+	std::string path = indexPath(arcName);
+	std::string tmpPath = path + ".XXXXXX";
+	int fd = mkstemp(&tmpPath[0]);
+	if (fd < 0) {
+		return false;
+	}
+	// mkstemp() makes it private to the user
+	fchmod(fd, 0644);
+	::close(fd);
+	File file;
+	if (!openInDirectory(file, tmpPath, "wb", FILE_BACKEND_STDIO)) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+	file.write(&header, sizeof(header));
+	if (!indexEntries.empty()) {
+		file.write(&indexEntries[0], indexEntries.size() * sizeof(IndexCacheEntry));
+	}
+	if (!zBlocks.empty()) {
+		file.write((void *)&zBlocks[0], zBlocks.size() * sizeof(uint32_t));
+	}
+	if (!names.empty()) {
+		file.write((void *)&names[0], names.size());
+	}
+	bool ok = !file.ioErr();
+	file.close();
+	if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,85 @@
+#ifndef INDEX_CACHE_H__
+#define INDEX_CACHE_H__
+
+#include <vector>
+#include "sys.h"
+#include "file.h"
+#include "psarc_header.h"
+#include "psarc_toc.h"
+
+
+// Identifies the archive an index was built from: an index is only used
+// when the archive at the same path still has this size, modification
+// time and header.
+struct IndexCacheKey {
+  uint64_t archiveSize;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  uint8_t header[Header::HEADER_SIZE];
+};
+
+// The index file is laid out so it can be used straight from a mapping,
+// in host byte order:
+//   IndexCacheHeader
+//   IndexCacheEntry[numEntries]
+//   uint32_t zBlocks[numBlocks]
+//   char names[namesSize]     NUL terminated names of entries 1..n
+struct IndexCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  IndexCacheKey key;
+  uint32_t numEntries;
+  uint32_t numBlocks;
+  uint64_t namesSize;
+};
+
+struct IndexCacheEntry {
+  char md5[16];
+  uint32_t zIndex;
+  uint32_t nameOffset;
+  uint64_t length;
+  uint64_t zOffset;
+};
+
+
+// Sidecar index of a PSARC archive, stored next to it as <archive>.idx.
+// It holds the parsed TOC, zBlocks and names so reopening an unchanged
+// archive skips decrypting the TOC and inflating the manifest.
+class IndexCache {
+public:
+  static const uint32_t MAGIC = 0x52534958; // "RSIX"
+  static const uint32_t VERSION = 1;
+
+  IndexCache();
+  ~IndexCache();
+
+  // Fills key from the archive at arcName and its raw header.
+  static bool makeKey(const char *arcName, const uint8_t *header, IndexCacheKey *key);
+
+  // Maps the index of arcName. Returns false when there is none, or when
+  // it is damaged or was built for another version of the archive.
+  bool open(const char *arcName, const IndexCacheKey& key);
+  void close();
+
+  uint32_t getNumEntries() const { return m_header->numEntries; }
+  const IndexCacheEntry *getEntries() const { return m_entries; }
+  uint32_t getNumBlocks() const { return m_header->numBlocks; }
+  const uint32_t *getZBlocks() const { return m_zBlocks; }
+  uint64_t getNamesSize() const { return m_header->namesSize; }
+  const char *getNames() const { return m_names; }
+
+  // Writes the index of arcName, replacing any previous one.
+  static bool write(const char *arcName, const IndexCacheKey& key, const Toc& toc, const std::vector<uint32_t>& zBlocks);
+
+private:
+  IndexCache(const IndexCache&);
+  IndexCache& operator=(const IndexCache&);
+
+  File m_file;
+  const IndexCacheHeader *m_header;
+  const IndexCacheEntry *m_entries;
+  const uint32_t *m_zBlocks;
+  const char *m_names;
+};
+
+#endif // INDEX_CACHE_H__
@@ -0,0 +1,87 @@
+#include "inflater.h"
+
+
+Inflater::Inflater() : m_initialized(false), m_error(NULL) {
+	memset(&m_stream, 0, sizeof(m_stream));
+}
+
+Inflater::~Inflater() {
+	if (m_initialized) {
+		inflateEnd(&m_stream);
+	}
+}
+
+
+int Inflater::start(uint8_t *dst, uint64_t dstLength) {
+	if (!m_initialized) {
+		int ret = inflateInit(&m_stream);
+		if (ret != Z_OK) {
+			m_error = "unable to initialize zlib";
+			return ret;
+		}
+		m_initialized = true;
+	} else {
+		inflateReset(&m_stream);
+	}
+	m_stream.next_out = dst;
+	m_stream.avail_out = dstLength;
+	m_error = NULL;
+	return Z_OK;
+}
+
+
+int Inflater::feed(const uint8_t *src, uint64_t srcLength) {
+	m_stream.next_in = (Bytef *)src;
+	m_stream.avail_in = srcLength;
+	int ret = ::inflate(&m_stream, Z_NO_FLUSH);
+	if (ret == Z_STREAM_END) {
+		return ret;
+	}
+	if (ret == Z_OK && m_stream.avail_in == 0) {
+		return Z_OK;
+	}
+	if (ret == Z_OK || ret == Z_BUF_ERROR) {
+		// Input left over, the output buffer is full
+		ret = Z_BUF_ERROR;
+	}
+	return setError(ret);
+}
+
+
+int Inflater::inflate(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength) {
+	int ret = start(dst, *dstLength);
+	if (ret != Z_OK) {
+		*dstLength = 0;
+		return ret;
+	}
+
+	m_stream.next_in = (Bytef *)src;
+	m_stream.avail_in = srcLength;
+	ret = ::inflate(&m_stream, Z_FINISH);
+	*dstLength = m_stream.total_out;
+
+	if (ret == Z_STREAM_END) {
+		return Z_OK;
+	}
+	if (ret == Z_BUF_ERROR || ret == Z_OK) {
+		// Z_FINISH without reaching the end of the stream
+		ret = (m_stream.avail_out == 0) ? Z_BUF_ERROR : Z_DATA_ERROR;
+	}
+	return setError(ret);
+}
+
+
+int Inflater::setError(int ret) {
+	if (ret == Z_NEED_DICT) {
+		ret = Z_DATA_ERROR;
+	}
+	m_error = (m_stream.msg != NULL) ? m_stream.msg
+		: (ret == Z_BUF_ERROR) ? "output buffer too small" : "truncated or corrupt data";
+	return ret;
+}
+
+
+Inflater& Inflater::forThread() {
+	static thread_local Inflater inflater;
+	return inflater;
+}
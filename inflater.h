@@ -0,0 +1,46 @@
+#ifndef INFLATER_H__
+#define INFLATER_H__
+
+#include "sys.h"
+
+
+// Inflates complete zlib streams, reusing one z_stream (and its window)
+// across calls instead of setting one up per call like uncompress() does.
+// An Inflater must only be used by one thread at a time, forThread()
+// returns the calling thread's own instance.
+class Inflater {
+public:
+  Inflater();
+  ~Inflater();
+
+  // Inflates the zlib stream in src into dst. On entry *dstLength is the
+  // size of dst, on return the number of bytes written. Returns Z_OK when
+  // the stream ended, otherwise a zlib error code (see getError()).
+  int inflate(uint8_t *dst, uint64_t *dstLength, const uint8_t *src, uint64_t srcLength);
+
+  // Inflates a stream that arrives in pieces: start() sets the output
+  // buffer, then each feed() passes on the next piece of input. feed()
+  // returns Z_OK while more input is expected, Z_STREAM_END once the
+  // stream ended (the rest of the input is ignored) or a zlib error code.
+  int start(uint8_t *dst, uint64_t dstLength);
+  int feed(const uint8_t *src, uint64_t srcLength);
+  // Bytes written since start().
+  uint64_t getTotalOut() const { return m_stream.total_out; }
+
+  // Description of the last error.
+  const char *getError() const { return m_error; }
+
+  static Inflater& forThread();
+
+private:
+  Inflater(const Inflater&);
+  Inflater& operator=(const Inflater&);
+
+  int setError(int ret);
+
+  z_stream m_stream;
+  bool m_initialized;
+  const char *m_error;
+};
+
+#endif // INFLATER_H__
@@ -4,9 +4,23 @@
  * Copyright (C) 2011-2018 Matthieu Milan
  */
 
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <exception>
 #include <getopt.h>
+#include <inttypes.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "aes_check.h"
+#include "benchmark.h"
+#include "buffer.h"
+#include "codec.h"
 #include "psarc.h"
 #include "options.h"
+#include "server.h"
 
 
 #define VERSION "0.2 alpha"
@@ -15,19 +29,257 @@
 void usage() {
 	printf("Usage: rscli [options/commands]\n");
 	printf("Options/commands:\n");
-	printf("\t-i:--input [filename]\tInput psarc file to use.\n");
+	printf("\t-i:--input [filename]\tInput psarc file to use. May be repeated, a directory\n");
+	printf("\t\t\t\tadds all .psarc files below it, @file the files listed\n");
+	printf("\t\t\t\tin file. Several archives are processed in parallel.\n");
 	printf("\t-l:--list\t\tList id, size, and name of every file in the archive.\n");
 	printf("\t-e:--extract\t\tExtract all files.\n");
 	printf("\t\t\t\tEncrypted .sng files will be decrypted during extraction.\n");
+	printf("\t--keep-decrypted\tAlso write the decrypted, still compressed .sng data.\n");
+	printf("\t-x:--extract-entry [name]\tExtract only the named file, may be repeated.\n");
+	printf("\t--verify\t\tCheck the names and blocks of all files without extracting.\n");
+	printf("\t--stats\t\t\tDisplay buffer pool statistics when done.\n");
+	printf("\t--index-cache\t\tKeep the parsed TOC in <archive>.idx and reuse it\n");
+	printf("\t\t\t\twhile the archive is unchanged.\n");
+	printf("\t--include [pattern]\tOnly list/extract files matching the glob pattern,\n");
+	printf("\t\t\t\t'!pattern' excludes. May be repeated.\n");
+	printf("\t--exclude [pattern]\tDo not list/extract files matching the glob pattern.\n");
+	printf("\t--serve [socket]\tAnswer list/stat/extract requests on a Unix socket,\n");
+	printf("\t\t\t\tkeeping recently used archives open.\n");
+	printf("\t--aes-check\t\tCheck the AES implementations and measure their speed.\n");
+	printf("\t--io-bench [filename]\tMeasure reading the file with each I/O backend, with\n");
+	printf("\t\t\t\ta cold and a warm page cache.\n");
+	printf("\t--inflate-bench\t\tMeasure the cost of inflating a block.\n");
+	printf("\t--stream\t\tExtract block by block using constant memory.\n");
+	printf("\t--codec [name]\t\tCompression library to use: %s (default: zlib).\n", Codec::getZlibNames());
 	printf("\t-o:--output [filename]\tOutput psarc file to write to (overwrites the file). (TODO)\n");
 	printf("\t-a:--appid [appid]\tSet AppID to the supplied value. (TODO)\n");
 	printf("\t-p:--platform [pc|mac]\tWrite .sng files as pc/mac in the output psarc file. (TODO)\n");
+	printf("\t--compression [zlib|lzma]\tCompression of the output psarc file (default: same as input).\n");
+	printf("\t--io [mmap|stdio|uring]\tI/O backend used to read the archive (default: mmap).\n");
+	printf("\t--threads [n]\t\tInflate blocks of large entries on n threads\n");
+	printf("\t\t\t\t(default: 1 for zlib, all cores for LZMA archives\n");
+	printf("\t\t\t\tand several archives).\n");
 //	printf("\t-v\t\tDisplay version.\n");
 }
 
+
+// An archive to process and the directory its files are extracted to
+struct Input {
+	std::string path;
+	std::string outputDir;
+};
+
+
+// Names the output directory of the archive file called name the way
+// PSARC::read() does.
+static std::string outputDirName(const std::string& name) {
+	std::string ext = ".psarc";
+	if (name.size() >= ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0) {
+		return name.substr(0, name.size() - ext.size());
+	}
+	return name + "_data";
+}
+
+
+// Adds all .psarc files below the directory path. Their output directories
+// keep their path below the directory given as input, which is prefix.
+static void addDirectory(std::vector<Input>& inputs, const std::string& path, const std::string& prefix) {
+	DIR *dir = opendir(path.c_str());
+	if (dir == NULL) {
+		printf("Error: Unable to read directory '%s'\n", path.c_str());
+		return;
+	}
+	std::vector<std::string> names;
+	struct dirent *dirEntry;
+	while ((dirEntry = readdir(dir)) != NULL) {
+		if (strcmp(dirEntry->d_name, ".") != 0 && strcmp(dirEntry->d_name, "..") != 0) {
+			names.push_back(dirEntry->d_name);
+		}
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+
+	char ext[] = ".psarc";
+	for (size_t i = 0; i < names.size(); i++) {
+		std::string child = path + "/" + names[i];
+		struct stat st;
+		if (stat(child.c_str(), &st) != 0) {
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			addDirectory(inputs, child, prefix + names[i] + "/");
+		} else if (names[i].size() >= strlen(ext) && names[i].compare(names[i].size() - strlen(ext), strlen(ext), ext) == 0) {
+			Input input = { child, prefix + outputDirName(names[i]) };
+			inputs.push_back(input);
+		}
+	}
+}
+
+
+// Adds path to inputs: a directory adds all .psarc files below it, a path
+// starting with '@' adds the paths listed in that file, one per line.
+static void addInput(std::vector<Input>& inputs, const char *path) {
+	if (path[0] == '@') {
+		FILE *list = fopen(path + 1, "r");
+		if (list == NULL) {
+			printf("Error: Unable to open list file '%s'\n", path + 1);
+			exit(1);
+		}
+		char line[4096];
+		while (fgets(line, sizeof(line), list) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (line[0] != '\0') {
+				addInput(inputs, line);
+			}
+		}
+		fclose(list);
+		return;
+	}
+
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+		addDirectory(inputs, path, "");
+		return;
+	}
+	std::string name(path);
+	Input input = { path, outputDirName(name.substr(name.rfind('/') + 1)) };
+	inputs.push_back(input);
+}
+
+
+// Runs the requested commands on options.inputFileName.
+static int processArchive(Options& options, BufferPool *buffers) {
+	PSARC psarc(options, NULL, buffers);
+	if (!psarc.read(options.inputFileName)) {
+		printf("Unable to open archive '%s'\n", options.inputFileName);
+		exit(1);
+	}
+
+	if (options.doList) {
+		psarc.displayFileList();
+	}
+
+	if (options.doExtract) {
+		psarc.extractAllFiles();
+	}
+
+	bool verified = true;
+	if (options.verify) {
+		verified = psarc.verify();
+	}
+
+	bool entriesFound = true;
+	for (size_t i = 0; i < options.extractEntries.size(); i++) {
+		entriesFound = psarc.extractEntry(options.extractEntries[i]) && entriesFound;
+	}
+
+	if (options.outputFileName != NULL) {
+		psarc.write(options);
+	}
+
+	return (entriesFound && verified) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Runs the requested commands on one archive of a batch, returns NULL or
+// what went wrong. Failures only affect this archive.
+static const char *processBatchArchive(const Options& options, const Input& input, ThreadPool *pool, BufferPool *buffers) {
+	const char *inputFileName = input.path.c_str();
+	try {
+		Options archiveOptions = options;
+		archiveOptions.outputDir = input.outputDir.c_str();
+		PSARC psarc(archiveOptions, pool, buffers);
+		if (!psarc.read(inputFileName)) {
+			return "unable to open archive";
+		}
+
+		if (options.doList) {
+			// Keep the list of one archive together
+			flockfile(stdout);
+			printf("%s:\n", inputFileName);
+			psarc.displayFileList();
+			funlockfile(stdout);
+		}
+
+		if (options.doExtract) {
+			psarc.extractAllFiles();
+		}
+
+		const char *error = NULL;
+		if (options.verify && !psarc.verify()) {
+			error = "corrupt entries";
+		}
+
+		for (size_t i = 0; i < options.extractEntries.size(); i++) {
+			if (!psarc.extractEntry(options.extractEntries[i]) && error == NULL) {
+				error = "named entry not found";
+			}
+		}
+		return error;
+	} catch (const std::exception& e) {
+		printf("Error processing '%s': %s\n", inputFileName, e.what());
+		return "internal error";
+	}
+}
+
+
+// Processes all archives on one work-stealing pool, which also
+// runs the per entry tasks of each archive.
+static int processArchives(const Options& options, const std::vector<Input>& inputs, BufferPool *buffers) {
+	if (options.doExtract || !options.extractEntries.empty()) {
+		// Archives extracted to the same directory would overwrite each other
+		std::map<std::string, size_t> outputDirs;
+		for (size_t i = 0; i < inputs.size(); i++) {
+			std::pair<std::map<std::string, size_t>::iterator, bool> added = outputDirs.insert(std::make_pair(inputs[i].outputDir, i));
+			if (!added.second) {
+				printf("Error: '%s' and '%s' would both be extracted to '%s'\n",
+					inputs[added.first->second].path.c_str(), inputs[i].path.c_str(), inputs[i].outputDir.c_str()
+				);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	uint32_t threads = options.threads;
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	ThreadPool pool(threads);
+	std::vector<const char *> errors(inputs.size(), (const char *)NULL);
+	// One task per thread takes the archives in turn, so that at most one
+	// archive per thread is open and the entry tasks of the open ones never
+	// queue up behind archives not started yet.
+	std::atomic<size_t> next(0);
+	TaskGroup group;
+	for (uint32_t runner = 0; runner < pool.getNumThreads() && runner < inputs.size(); runner++) {
+		pool.run(group, [&options, &inputs, &errors, &pool, &next, buffers]() {
+			for (size_t i = next++; i < inputs.size(); i = next++) {
+				errors[i] = processBatchArchive(options, inputs[i], &pool, buffers);
+			}
+		});
+	}
+	pool.wait(group);
+
+	uint32_t failed = 0;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		if (errors[i] != NULL) {
+			failed++;
+		}
+	}
+	printf("%d archives processed: %d ok, %d failed\n", (int)inputs.size(), (int)(inputs.size() - failed), failed);
+	for (size_t i = 0; i < inputs.size(); i++) {
+		if (errors[i] != NULL) {
+			printf("\t%s: %s\n", inputs[i].path.c_str(), errors[i]);
+		}
+	}
+	return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
 int main(int argc, char *argv[]) {
-	PSARC psarc;
 	Options options;
+	std::vector<Input> inputs;
 	int verbose_flag;
 
 	static struct option long_options[] = {
@@ -36,16 +288,32 @@ int main(int argc, char *argv[]) {
 	  /* These options don’t set a flag. We distinguish them by their indices. */
 	  {"list",     no_argument,       0, 'l'},
 	  {"extract",  no_argument,       0, 'e'},
+	  {"extract-entry", required_argument, 0, 'x'},
 	  {"input",    required_argument, 0, 'i'},
 		{"output",   required_argument, 0, 'o'},
 		{"appid",    required_argument, 0, 'a'},
 		{"platform", required_argument, 0, 'p'},
+		{"io",       required_argument, 0, 'I'},
+		{"threads",  required_argument, 0, 'T'},
+		{"stream",   no_argument,       0, 'S'},
+		{"index-cache", no_argument,    0, 'K'},
+		{"verify",   no_argument,       0, 'V'},
+		{"stats",    no_argument,       0, 'B'},
+		{"codec",    required_argument, 0, 'C'},
+		{"compression", required_argument, 0, 'Z'},
+		{"include",  required_argument, 0, 'N'},
+		{"exclude",  required_argument, 0, 'X'},
+		{"serve",    required_argument, 0, 'E'},
+		{"aes-check", no_argument,      0, 'A'},
+		{"io-bench", required_argument, 0, 'R'},
+		{"inflate-bench", no_argument,  0, 'F'},
+		{"keep-decrypted", no_argument, 0, 'D'},
 	  {0, 0, 0, 0}
 	};
 
 	while (1) {
 		int option_index = 0;
-		int c = getopt_long(argc, argv, "i:leo:a:p:", long_options, &option_index);
+		int c = getopt_long(argc, argv, "i:lex:o:a:p:", long_options, &option_index);
 		if (c == -1) break;
 		switch (c)
 			{
@@ -57,8 +325,12 @@ int main(int argc, char *argv[]) {
 				options.doExtract = true;
 				break;
 
+			case 'x':
+				options.extractEntries.push_back(optarg);
+				break;
+
 			case 'i':
-				options.inputFileName = optarg;
+				addInput(inputs, optarg);
 				break;
 
 			case 'o':
@@ -80,6 +352,91 @@ int main(int argc, char *argv[]) {
 				}
 				break;
 
+			case 'I':
+				if (strcmp(optarg, "stdio") == 0) {
+					options.fileBackend = FILE_BACKEND_STDIO;
+				} else if (strcmp(optarg, "mmap") == 0) {
+					options.fileBackend = FILE_BACKEND_MMAP;
+				} else if (strcmp(optarg, "uring") == 0) {
+					options.fileBackend = FILE_BACKEND_URING;
+				} else {
+					printf("Error: Unknown I/O backend '%s'\n", optarg);
+					exit(1);
+				}
+				break;
+
+			case 'T':
+				if (atoi(optarg) < 1) {
+					printf("Error: Invalid number of threads '%s'\n", optarg);
+					exit(1);
+				}
+				options.threads = atoi(optarg);
+				break;
+
+			case 'S':
+				options.streamExtract = true;
+				break;
+
+			case 'K':
+				options.indexCache = true;
+				break;
+
+			case 'V':
+				options.verify = true;
+				break;
+
+			case 'B':
+				options.bufferStats = true;
+				break;
+
+			case 'C':
+				if (Codec::getZlib(optarg) == NULL) {
+					printf("Error: Unknown/unavailable codec '%s' (available: %s)\n", optarg, Codec::getZlibNames());
+					exit(1);
+				}
+				options.codecName = optarg;
+				break;
+
+			case 'Z':
+				if (strcmp(optarg, "zlib") == 0) {
+					options.outputCompression = Header::COMPRESSION_ZLIB;
+				} else if (strcmp(optarg, "lzma") == 0 && Codec::get("lzma") != NULL) {
+					options.outputCompression = Header::COMPRESSION_LZMA;
+				} else {
+					printf("Error: Unknown/unsupported compression '%s'\n", optarg);
+					exit(1);
+				}
+				break;
+
+			case 'N':
+				if (optarg[0] == '!') {
+					options.excludePatterns.push_back(optarg + 1);
+				} else {
+					options.includePatterns.push_back(optarg);
+				}
+				break;
+
+			case 'X':
+				options.excludePatterns.push_back(optarg);
+				break;
+
+			case 'E':
+				options.serveSocket = optarg;
+				break;
+
+			case 'A':
+				return checkCipher() ? 0 : 1;
+
+			case 'R':
+				return benchmarkFile(optarg) ? 0 : 1;
+
+			case 'F':
+				return benchmarkInflate() ? 0 : 1;
+
+			case 'D':
+				options.keepDecrypted = true;
+				break;
+
 			case '?':
 				/* getopt_long already printed an error message. */
 				break;
@@ -91,28 +448,39 @@ int main(int argc, char *argv[]) {
 
 	options.verbose_flag = verbose_flag;
 
-	if (options.inputFileName == NULL) {
+	for (int i = optind; i < argc; i++) {
+		addInput(inputs, argv[i]);
+	}
+	if (options.serveSocket != NULL) {
+		Server server(options);
+		return server.serve(options.serveSocket) ? 0 : 1;
+	}
+	if (inputs.empty()) {
 		printf("No inputfile specified\n");
 		usage();
 		exit(1);
 	}
 
-	if (!psarc.read(options.inputFileName)) {
-		printf("Unable to open archive '%s'\n", options.inputFileName);
-		exit(1);
+	BufferPool buffers;
+	int status;
+	if (inputs.size() == 1) {
+		options.inputFileName = inputs[0].path.c_str();
+		options.outputDir = inputs[0].outputDir.c_str();
+		status = processArchive(options, &buffers);
+	} else {
+		if (options.outputFileName != NULL) {
+			printf("Error: --output needs a single input archive\n");
+			exit(1);
+		}
+		status = processArchives(options, inputs, &buffers);
 	}
 
-	if (options.doList) {
-		psarc.displayFileList();
-	}
-
-	if (options.doExtract) {
-		psarc.extractAllFiles();
-	}
-
-	if (options.outputFileName != NULL) {
-		psarc.write(options);
+	if (options.bufferStats) {
+		BufferPoolStats stats = buffers.getStats();
+		printf("Buffers: %" PRIu64 " allocations (%" PRIu64 " reused), high water %" PRIu64 " bytes, %" PRIu64 " bytes cached\n",
+			stats.allocations, stats.reused, stats.highWater, stats.cached
+		);
 	}
 
-	return EXIT_SUCCESS;
+	return status;
 }
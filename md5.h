@@ -0,0 +1,27 @@
+#ifndef MD5_H__
+#define MD5_H__
+
+#include "sys.h"
+
+
+// MD5 message digest (RFC 1321), used for the name hashes in the TOC.
+class Md5 {
+public:
+  static const uint32_t DIGEST_SIZE = 16;
+
+  Md5();
+
+  void update(const void *data, uint64_t length);
+  void final(uint8_t *digest);
+
+  static void digest(const void *data, uint64_t length, uint8_t *digest);
+
+private:
+  void transform(const uint8_t *block);
+
+  uint32_t m_state[4];
+  uint64_t m_length;
+  uint8_t m_buffer[64];
+};
+
+#endif // MD5_H__
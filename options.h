@@ -1,6 +1,8 @@
 #ifndef OPTIONS_H__
 #define OPTIONS_H__
 
+#include <vector>
+#include "file.h"
 #include "psarc_platform.h"
 
 class Options {
@@ -13,15 +15,40 @@ public:
     , doList(false)
     , doExtract(false)
     , targetPlatform(PLATFORM_NONE)
+    , fileBackend(FILE_BACKEND_MMAP)
+    , threads(0)
+    , streamExtract(false)
+    , indexCache(false)
+    , verify(false)
+    , bufferStats(false)
+    , serveSocket(NULL)
+    , keepDecrypted(false)
+    , codecName("zlib")
+    , outputCompression(0)
+    , outputDir(NULL)
   {}
 
   bool verbose_flag;
-	char *inputFileName;
+	const char *inputFileName;
 	char *outputFileName;
 	char *newAppId;
 	bool doList;
 	bool doExtract;
 	platform targetPlatform;
+	FileBackend fileBackend;
+	uint32_t threads; // 0: automatic
+	bool streamExtract;
+	bool indexCache;
+	bool verify;
+	bool bufferStats;
+	const char *serveSocket;
+	bool keepDecrypted;
+	const char *codecName;
+	uint32_t outputCompression;
+	const char *outputDir; // NULL: named after the archive
+	std::vector<const char *> extractEntries;
+	std::vector<const char *> includePatterns;
+	std::vector<const char *> excludePatterns;
 };
 
 
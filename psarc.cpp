@@ -3,140 +3,406 @@
  * Copyright (C) 2011-2018 Matthieu Milan
  */
 
+#include <atomic>
+#include <cstdarg>
 #include <cstdio>
+#include <fnmatch.h>
 #include <inttypes.h>
 #include "psarc.h"
-#include "Rijndael.h"
+#include "aes.h"
+#include "bounded_queue.h"
+#include "codec.h"
+#include "index_cache.h"
+#include "inflater.h"
+#include "md5.h"
+#include "psarc_keys.h"
 #include "sys.h"
 
 
-static const char PsarcKey[32] =
-{
-	0xC5, 0x3D, 0xB2, 0x38, 0x70, 0xA1, 0xA2, 0xF7,
-	0x1C, 0xAE, 0x64, 0x06, 0x1F, 0xDD, 0x0E, 0x11,
-	0x57, 0x30, 0x9D, 0xC8, 0x52, 0x04, 0xD4, 0xC5,
-	0xBF, 0xDF, 0x25, 0x09, 0x0D, 0xF2, 0x57, 0x2C
-};
+static const Aes256 PsarcCipher(PsarcKeySchedule);
+static const Aes256 SngCipherMac(SngKeyMacSchedule);
+static const Aes256 SngCipherPC(SngKeyPCSchedule);
 
-
-static const char SngKeyMac[32] =
-{
-		0x98, 0x21, 0x33, 0x0E, 0x34, 0xB9, 0x1F, 0x70,
-		0xD0, 0xA4, 0x8C, 0xBD, 0x62, 0x59, 0x93, 0x12,
-		0x69, 0x70, 0xCE, 0xA0, 0x91, 0x92, 0xC0, 0xE6,
-		0xCD, 0xA6, 0x76, 0xCC, 0x98, 0x38, 0x28, 0x9D
-};
-
-
-static const char SngKeyPC[32] =
-{
-		0xCB, 0x64, 0x8D, 0xF3, 0xD1, 0x2A, 0x16, 0xBF,
-		0x71, 0x70, 0x14, 0x14, 0xE6, 0x96, 0x19, 0xEC,
-		0x17, 0x1C, 0xCA, 0x5D, 0x2A, 0x14, 0x2E, 0x3E,
-		0x59, 0xDE, 0x7A, 0xDD, 0xA1, 0x8A, 0x3A, 0x30
-};
+static const uint8_t TocIv[Aes256::BLOCK_SIZE] = { 0 };
 
 #define MAX_ENCRYPTION_BLOCK_SIZE 32
+// .sng files: magic, flags, IV, then the encrypted payload
+#define SNG_PAYLOAD_OFFSET 24
 
 
 PSARC::PSARC() {
-	_buffer = (uint8_t *)malloc(600 * 1024);
 	baseDir = NULL;
+	m_threads = 1;
+	m_pool = NULL;
+	m_ownsPool = false;
+	m_bufferPool = &m_ownBufferPool;
+	m_codec = Codec::get("zlib");
+}
+
+PSARC::PSARC(const Options& options, ThreadPool *pool, BufferPool *bufferPool) : m_options(options) {
+	baseDir = NULL;
+	m_threads = 1;
+	m_pool = pool;
+	m_ownsPool = false;
+	m_bufferPool = (bufferPool != NULL) ? bufferPool : &m_ownBufferPool;
+	// LZMA archives switch to the lzma codec by themselves
+	m_codec = Codec::getZlib(options.codecName);
+	if (m_codec == NULL) {
+		printf("Codec '%s' is not available, using zlib\n", options.codecName);
+		m_options.codecName = "zlib";
+		m_codec = Codec::get("zlib");
+	}
 }
 
 PSARC::~PSARC() {
+	close();
+	if (m_ownsPool) {
+		delete m_pool;
+	}
+}
+
+
+// Forgets the archive that was read. The buffer and thread pools are kept
+// for the next archive.
+void PSARC::close() {
 	_f.close();
-	free(_buffer);
-	if (baseDir != NULL)
+	m_entries.clear();
+	m_toc.resize(0);
+	m_zBlocks.clear();
+	m_header = Header();
+	m_codec = Codec::getZlib(m_options.codecName);
+	if (baseDir != NULL) {
 		free(baseDir);
+		baseDir = NULL;
+	}
+}
+
+
+// Hands a message about a damaged or unreadable archive to the error
+// handler, or prints it when there is none.
+void PSARC::reportError(const char *format, ...) const {
+	char message[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	if (m_errorHandler) {
+		m_errorHandler(message);
+	} else {
+		printf("%s\n", message);
+	}
+}
+
+
+// Returns size bytes at offset, straight from the file mapping when there is
+// one, otherwise read into buffer. Does not touch the shared file offset.
+// Returns NULL on a short read.
+const uint8_t *PSARC::readBlock(uint64_t offset, uint32_t size, uint8_t *buffer) const {
+	const uint8_t *block = _f.map(offset, size);
+	if (block == NULL) {
+		if (buffer == NULL || !_f.readAt(offset, buffer, size))
+			return NULL;
+		block = buffer;
+	}
+	return block;
+}
+
+
+uint64_t PSARC::getCompressedLength(const Entry& entry) const {
+	const uint32_t *zBlocks = m_zBlocks.data();
+	uint32_t cBlockSize = m_header.getBlockSizeAlloc();
+	uint64_t compressedLength = 0;
+	uint32_t zIndex = entry.getZIndex();
+	for (uint64_t length = 0; length < entry.getLength(); length += cBlockSize) {
+		compressedLength += (zBlocks[zIndex] == 0) ? cBlockSize : zBlocks[zIndex];
+		zIndex++;
+	}
+	return compressedLength;
+}
+
+
+// Reads block number block of entry, starting at readOffset in the archive,
+// and inflates it into out (at least blockSizeAlloc bytes). When src is not
+// NULL it holds all compressed blocks of the entry, otherwise the block is
+// read into buffer. Returns the number of bytes written, 0 when the block is
+// unreadable. Only uses readAt()/map(), so it may run on any thread.
+uint64_t PSARC::readEntryBlock(const Entry& entry, uint32_t block, uint64_t readOffset, const uint8_t *src, uint8_t *buffer, uint8_t *out) const {
+	uint32_t cBlockSize = m_header.getBlockSizeAlloc();
+	uint32_t zIndex = entry.getZIndex() + block;
+	uint32_t zBlockSize = m_zBlocks[zIndex];
+	uint64_t writeOffset = (uint64_t)block * cBlockSize;
+
+	if (zBlockSize == 0) {
+		// A stored full block, which the last block of an entry cannot be
+		if (entry.getLength() - writeOffset < cBlockSize) {
+			reportError("Invalid size of block %d of entry %d", zIndex, entry.getId());
+			return 0;
+		}
+		const uint8_t *in = (src != NULL)
+			? src + (readOffset - entry.getZOffset())
+			: readBlock(readOffset, cBlockSize, out);
+		if (in == NULL) {
+			reportError("Unable to read block %d of entry %d", zIndex, entry.getId());
+			return 0;
+		}
+		if (in != out) {
+			memcpy(out, in, cBlockSize);
+		}
+		return cBlockSize;
+	}
+
+	const uint8_t *in = (src != NULL)
+		? src + (readOffset - entry.getZOffset())
+		: readBlock(readOffset, zBlockSize, buffer);
+	if (in == NULL) {
+		reportError("Unable to read block %d of entry %d", zIndex, entry.getId());
+		return 0;
+	}
+	uint64_t uncompressSize = cBlockSize;
+	if (entry.getLength() - writeOffset < cBlockSize) {
+		uncompressSize = entry.getLength() - writeOffset;
+	}
+	// zlib blocks are recognized by their header, LZMA blocks are stored
+	// whenever they did not get smaller.
+	bool compressed = m_header.isLzma()
+		? zBlockSize < uncompressSize
+		: (in[0] == 0x78 && in[1] == 0xda);
+	if (compressed) {
+		const char *error = NULL;
+		if (!m_codec->decompress(out, &uncompressSize, in, zBlockSize, &error)) {
+			reportError("Unable to inflate block %d of entry %d: %s", zIndex, entry.getId(), error);
+			return 0;
+		}
+		return uncompressSize;
+	}
+	if (zBlockSize > uncompressSize) {
+		reportError("Invalid size of block %d of entry %d", zIndex, entry.getId());
+		return 0;
+	}
+	memcpy(out, in, zBlockSize);
+	return zBlockSize;
 }
 
 
-void PSARC::readEntry(Entry& entry, uint32_t *zBlocks, uint32_t cBlockSize) {
+// When src is not NULL it holds all compressed blocks of the entry,
+// otherwise they are fetched from the file. Entries of at least
+// PARALLEL_MIN_BLOCKS blocks are inflated on the thread pool, each task
+// writing straight into the slots of its blocks. Returns false when the
+// data could not all be read.
+bool PSARC::readEntry(Entry& entry, const uint8_t *src) {
 	if (entry.getLength() != 0 && entry.getData() == NULL) {
-		uint8_t *data = (uint8_t *)malloc(entry.getLength() + MAX_ENCRYPTION_BLOCK_SIZE);
-		entry.setData(data);
-		_f.seek(entry.getZOffset());
-		uint32_t zIndex = entry.getZIndex();
+		uint32_t cBlockSize = m_header.getBlockSizeAlloc();
+		Buffer buffer = m_bufferPool->get(entry.getLength() + MAX_ENCRYPTION_BLOCK_SIZE);
+		if (buffer.isEmpty()) {
+			// The length comes from the TOC and may be anything
+			reportError("Unable to allocate %" PRIu64 " bytes for entry %d", entry.getLength(), entry.getId());
+			return false;
+		}
+		buffer.setSize(entry.getLength());
+		uint8_t *data = buffer.data();
+		entry.setData(std::move(buffer));
+		uint32_t numBlocks = (entry.getLength() + cBlockSize - 1) / cBlockSize;
 		uint64_t writeOffset = 0;
-		do {
-			if (zBlocks[zIndex] == 0) {
-				_f.read(data + writeOffset, cBlockSize);
-				writeOffset += cBlockSize;
-			} else {
-				_f.read(_buffer, zBlocks[zIndex]);
-				if (_buffer[0] == 0x78 && _buffer[1] == 0xda) {
-					uLongf uncompressSize;
-					uint32_t val = entry.getLength() - (zIndex - entry.getZIndex()) * cBlockSize;
-					if (val < cBlockSize) {
-						uncompressSize = (uLongf)val;
-					} else {
-						uncompressSize = (uLongf)cBlockSize;
+
+		uint32_t minBlocks = m_header.isLzma() ? PARALLEL_MIN_BLOCKS_LZMA : PARALLEL_MIN_BLOCKS;
+		if (m_pool != NULL && numBlocks >= minBlocks) {
+			std::vector<uint64_t> readOffsets(numBlocks);
+			uint64_t readOffset = entry.getZOffset();
+			for (uint32_t i = 0; i < numBlocks; i++) {
+				readOffsets[i] = readOffset;
+				uint32_t zBlockSize = m_zBlocks[entry.getZIndex() + i];
+				readOffset += (zBlockSize == 0) ? cBlockSize : zBlockSize;
+			}
+			uint32_t numTasks = m_pool->getNumThreads() * 4;
+			if (numTasks > numBlocks)
+				numTasks = numBlocks;
+			std::vector<uint64_t> written(numTasks, 0);
+			TaskGroup group;
+			for (uint32_t task = 0; task < numTasks; task++) {
+				uint32_t first = (uint64_t)numBlocks * task / numTasks;
+				uint32_t last = (uint64_t)numBlocks * (task + 1) / numTasks;
+				m_pool->run(group, [this, &entry, &readOffsets, &written, src, task, first, last, cBlockSize]() {
+					Buffer buffer;
+					if (src == NULL) {
+						buffer = m_bufferPool->get(cBlockSize);
 					}
-					uncompress(data + writeOffset, &uncompressSize, _buffer, zBlocks[zIndex]);
-					writeOffset += uncompressSize;
-				} else {
-					memcpy(data + writeOffset, _buffer, zBlocks[zIndex]);
-					writeOffset += zBlocks[zIndex];
-				}
+					for (uint32_t i = first; i < last; i++) {
+						written[task] += readEntryBlock(entry, i, readOffsets[i], src, buffer.data(), entry.getData() + (uint64_t)i * cBlockSize);
+					}
+				});
+			}
+			m_pool->wait(group);
+			for (uint32_t task = 0; task < numTasks; task++) {
+				writeOffset += written[task];
 			}
-			zIndex++;
-		} while (writeOffset < entry.getLength());
+		} else {
+			Buffer buffer;
+			if (src == NULL) {
+				buffer = m_bufferPool->get(cBlockSize);
+			}
+			uint64_t readOffset = entry.getZOffset();
+			for (uint32_t i = 0; i < numBlocks; i++) {
+				uint64_t blockWritten = readEntryBlock(entry, i, readOffset, src, buffer.data(), data + (uint64_t)i * cBlockSize);
+				if (blockWritten == 0)
+					break;
+				writeOffset += blockWritten;
+				uint32_t zBlockSize = m_zBlocks[entry.getZIndex() + i];
+				readOffset += (zBlockSize == 0) ? cBlockSize : zBlockSize;
+			}
+		}
 		if (writeOffset != entry.getLength()) {
-			printf("File size : %" PRId64 " bytes. Expected size: %" PRId64 " bytes\n",
+			reportError("File size : %" PRId64 " bytes. Expected size: %" PRId64 " bytes",
 				writeOffset, entry.getLength()
 			);
+			return false;
 		}
 	}
+	return true;
+}
+
+
+// Reads the compressed blocks of a run of entries starting at first with a
+// single batched request, then inflates them. Returns the index following
+// the last entry read.
+uint32_t PSARC::readEntries(uint32_t first) {
+	FileReadRequest requests[READ_BATCH_ENTRIES];
+	uint64_t batchOffsets[READ_BATCH_ENTRIES];
+	uint32_t count = 0;
+	uint64_t totalLength = 0;
+	uint32_t last = first;
+	while (last < m_header.getNumFiles() && count < READ_BATCH_ENTRIES) {
+		Entry& entry = m_entries.at(last);
+		uint64_t compressedLength = 0;
+		if (entry.getLength() != 0 && entry.getData() == NULL && isSelected(entry.getId())) {
+			compressedLength = getCompressedLength(entry);
+			if (count > 0 && totalLength + compressedLength > READ_BATCH_BYTES)
+				break;
+			requests[count].offset = entry.getZOffset();
+			requests[count].size = compressedLength;
+			batchOffsets[count] = totalLength;
+			count++;
+		}
+		totalLength += compressedLength;
+		last++;
+	}
+
+	Buffer batch = m_bufferPool->get(totalLength);
+	for (uint32_t i = 0; i < count; i++) {
+		requests[i].ptr = batch.data() + batchOffsets[i];
+		requests[i].done = false;
+	}
+	// Without the batch buffer each entry is read on its own
+	if (!batch.isEmpty()) {
+		_f.readBatch(requests, count);
+	}
+
+	uint32_t request = 0;
+	for (uint32_t i = first; i < last; i++) {
+		Entry& entry = m_entries.at(i);
+		if (entry.getLength() != 0 && entry.getData() == NULL && isSelected(entry.getId())) {
+			readEntry(entry, requests[request].done ? (uint8_t *)requests[request].ptr : NULL);
+			request++;
+		}
+	}
+	return last;
+}
+
+
+// Reads, inflates and decrypts the data of an entry unless that was already
+// done. Entry 0 is parsed as the file name list instead. Returns false when
+// the data is missing, or could not all be read when it was loaded.
+bool PSARC::loadEntry(Entry& entry) {
+	bool complete = true;
+	if (!entry.isLoaded()) {
+		complete = readEntry(entry);
+		if (entry.getId() == 0) {
+			parseTocEntry(entry);
+		} else {
+			decryptEntry(entry);
+		}
+		entry.setLoaded(true);
+	}
+	return complete && (entry.getLength() == 0 || entry.getData() != NULL);
+}
+
+
+// Counter mode encryption or decryption of an .sng payload. Payloads of
+// several PARALLEL_CIPHER_CHUNK bytes are split over the thread pool, the
+// counter of each chunk is the IV plus the number of blocks before it.
+void PSARC::sngCipher(const Aes256& aes, const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const {
+	uint64_t numChunks = (length + PARALLEL_CIPHER_CHUNK - 1) / PARALLEL_CIPHER_CHUNK;
+	if (m_pool == NULL || numChunks < 2) {
+		aes.ctr(iv, in, out, length);
+		return;
+	}
+	TaskGroup group;
+	for (uint64_t chunk = 0; chunk < numChunks; chunk++) {
+		m_pool->run(group, [&aes, iv, in, out, length, chunk]() {
+			uint64_t offset = chunk * PARALLEL_CIPHER_CHUNK;
+			uint64_t size = length - offset;
+			if (size > PARALLEL_CIPHER_CHUNK) {
+				size = PARALLEL_CIPHER_CHUNK;
+			}
+			uint8_t counter[Aes256::BLOCK_SIZE];
+			memcpy(counter, iv, Aes256::BLOCK_SIZE);
+			Aes256::addToCounter(counter, offset / Aes256::BLOCK_SIZE);
+			aes.ctr(counter, in + offset, out + offset, size);
+		});
+	}
+	m_pool->wait(group);
 }
 
 
 void PSARC::decryptEntry(Entry& entry) {
 	if (entry.getLength() > 8 && entry.getData() != NULL && entry.getName() != NULL) {
 		uint8_t *data = entry.getData();
-		if (entry.hasExtension(".sng")) {
+		if (entry.hasExtension(".sng") && entry.getLength() >= SNG_PAYLOAD_OFFSET + Aes256::BLOCK_SIZE) {
 			if (READ_LE_UINT32(data) == 0x4a) {
 				if (READ_LE_UINT32(data + 4) == 0x03) {
 					entry.setEncrypted(true);
 					entry.setOriginalPlatform(determineSngOriginalPlatform(data));
-					const char *key = NULL;
+					const Aes256 *cipher = NULL;
 					if (entry.getOriginalPlatform() == PLATFORM_PC) {
-						key = SngKeyPC;
+						cipher = &SngCipherPC;
 					}
 					if (entry.getOriginalPlatform() == PLATFORM_MAC) {
-						key = SngKeyMac;
+						cipher = &SngCipherMac;
+					}
+					if (cipher == NULL) {
+						reportError("Unable to determine original platform for '%s'", entry.getName());
+						return;
+					}
+					if (!m_options.keepDecrypted && m_options.targetPlatform == PLATFORM_NONE) {
+						inflateSngStreamed(entry, *cipher);
+						return;
+					}
+					// Kept to be written out or encrypted for another platform
+					Buffer decrypted = m_bufferPool->get(entry.getLength());
+					if (decrypted.isEmpty()) {
+						reportError("Unable to allocate %" PRIu64 " bytes for entry %d", entry.getLength(), entry.getId());
+						return;
 					}
-					if (key == NULL) {
-						printf("Unable to determine original platform for '%s'\n", entry.getName());
+					decrypted.setSize(entry.getLength());
+					uint8_t *decryptedSng = decrypted.data();
+					entry.setDecryptedData(std::move(decrypted));
+					// The payload follows the 8 byte header and the 16 byte IV,
+					// the rest of the decrypted buffer is left zeroed.
+					uint64_t payloadLength = entry.getLength() - SNG_PAYLOAD_OFFSET;
+					sngCipher(*cipher, data + 8, data + SNG_PAYLOAD_OFFSET, decryptedSng, payloadLength);
+					memset(decryptedSng + payloadLength, 0, SNG_PAYLOAD_OFFSET);
+					uint64_t uncompressedSize = READ_LE_UINT32(decryptedSng);
+					Buffer decompressed = m_bufferPool->get(uncompressedSize);
+					if (decompressed.isEmpty()) {
+						reportError("Unable to allocate %" PRIu64 " bytes for entry %d", uncompressedSize, entry.getId());
 						return;
 					}
-					uint64_t offset = 8;
-					uint64_t writeOffset = 0;
-					uint8_t blockLength = 16;
-					uint8_t *decryptedSng = (uint8_t *)malloc(entry.getLength() + MAX_ENCRYPTION_BLOCK_SIZE);
-					entry.setDecryptedLength(entry.getLength());
-					entry.setDecryptedData(decryptedSng);
-					char iv[16];
-					for (int i = 0; i < 16; i++) {
-						iv[i] = data[offset++];
+					decompressed.setSize(uncompressedSize);
+					uint8_t *uncompressedData = decompressed.data();
+					entry.setDecompressedData(std::move(decompressed));
+					Inflater& inflater = Inflater::forThread();
+					if (inflater.inflate(uncompressedData, &uncompressedSize, decryptedSng + 4, entry.getLength() - 28) != Z_OK) {
+						reportError("Unable to inflate '%s': %s", entry.getName(), inflater.getError());
 					}
-					CRijndael rijndael;
-
-					do {
-						rijndael.MakeKey(key, iv, 32, blockLength);
-  					rijndael.Decrypt((char *)data + offset, (char *)decryptedSng + writeOffset, blockLength, CRijndael::CFB);
-						offset += blockLength;
-						writeOffset += blockLength;
-						bool carry = true;
-						for (int j = 15; j >= 0 && carry; j--) {
-								carry = ((iv[j] = (iv[j] + 1)) == 0);
-						}
-					} while (offset < entry.getLength());
-					uLongf uncompressedSize = READ_LE_UINT32(decryptedSng);
-					uint8_t *uncompressedData = (uint8_t *)malloc(uncompressedSize);
-					entry.setDecompressedLength(uncompressedSize);
-					entry.setDecompressedData(uncompressedData);
-					uncompress(uncompressedData, &uncompressedSize, decryptedSng + 4, entry.getLength() - 28);
 				}
 			}
 		}
@@ -144,70 +410,82 @@ void PSARC::decryptEntry(Entry& entry) {
 }
 
 
+// Decrypts the payload of an .sng SNG_STREAM_CHUNK bytes at a time, each
+// chunk going straight from the cache into the inflater, so that only the
+// decompressed data is kept.
+void PSARC::inflateSngStreamed(Entry& entry, const Aes256& aes) {
+	const uint8_t *payload = entry.getData() + SNG_PAYLOAD_OFFSET;
+	uint64_t payloadLength = entry.getLength() - SNG_PAYLOAD_OFFSET;
+	uint8_t counter[Aes256::BLOCK_SIZE];
+	memcpy(counter, entry.getData() + 8, Aes256::BLOCK_SIZE);
+	Buffer chunk = m_bufferPool->get(SNG_STREAM_CHUNK);
+	if (chunk.isEmpty()) {
+		reportError("Unable to allocate %" PRIu64 " bytes for entry %d", SNG_STREAM_CHUNK, entry.getId());
+		return;
+	}
+	Inflater& inflater = Inflater::forThread();
+
+	int ret = Z_OK;
+	for (uint64_t offset = 0; offset < payloadLength && ret == Z_OK; offset += SNG_STREAM_CHUNK) {
+		uint64_t size = payloadLength - offset;
+		if (size > SNG_STREAM_CHUNK) {
+			size = SNG_STREAM_CHUNK;
+		}
+		aes.ctr(counter, payload + offset, chunk.data(), size);
+		Aes256::addToCounter(counter, size / Aes256::BLOCK_SIZE);
+		uint32_t skip = 0;
+		if (offset == 0) {
+			// The payload starts with the size of the decompressed data
+			uint64_t uncompressedSize = READ_LE_UINT32(chunk.data());
+			Buffer decompressed = m_bufferPool->get(uncompressedSize);
+			if (decompressed.isEmpty()) {
+				reportError("Unable to allocate %" PRIu64 " bytes for entry %d", uncompressedSize, entry.getId());
+				return;
+			}
+			decompressed.setSize(uncompressedSize);
+			ret = inflater.start(decompressed.data(), uncompressedSize);
+			entry.setDecompressedData(std::move(decompressed));
+			skip = 4;
+		}
+		if (ret == Z_OK) {
+			ret = inflater.feed(chunk.data() + skip, size - skip);
+		}
+	}
+	if (ret != Z_STREAM_END) {
+		reportError("Unable to inflate '%s': %s", entry.getName(), (ret == Z_OK) ? "truncated or corrupt data" : inflater.getError());
+	}
+}
+
+
 void PSARC::encryptEntry(Entry& entry, platform targetPlatform) {
 	if (entry.getDecryptedLength() > 8 + 16 && entry.getDecryptedData() != NULL && entry.isEncrypted()) {
 		uint8_t *decryptedData = entry.getDecryptedData();
 		uint8_t *data = entry.getData();
-		const char *key = NULL;
+		const Aes256 *cipher = NULL;
 		if (targetPlatform == PLATFORM_PC) {
-			key = SngKeyPC;
+			cipher = &SngCipherPC;
 		}
 		if (targetPlatform == PLATFORM_MAC) {
-			key = SngKeyMac;
+			cipher = &SngCipherMac;
 		}
-		if (key == NULL) {
-			printf("Unable to determine target platform encrypted key for '%s'\n", entry.getName());
+		if (cipher == NULL) {
+			reportError("Unable to determine target platform encrypted key for '%s'", entry.getName());
 			return;
 		}
-		uint64_t offset = 8;
-		uint64_t readOffset = 0;
-		uint8_t blockLength = 16;
-		char iv[16];
-		for (int i = 0; i < 16; i++) {
-			iv[i] = decryptedData[offset++];
-		}
-		CRijndael rijndael;
-
-		do {
-			rijndael.MakeKey(key, iv, 32, blockLength);
-			rijndael.Encrypt((char *)decryptedData + readOffset, (char *)data + offset, blockLength, CRijndael::CFB);
-			offset += blockLength;
-			readOffset += blockLength;
-			bool carry = true;
-			for (int j = 15; j >= 0 && carry; j--) {
-					carry = ((iv[j] = (iv[j] + 1)) == 0);
-			}
-		} while (readOffset < entry.getDecryptedLength());
+		// Same IV as the original, only the key changes
+		sngCipher(*cipher, data + 8, decryptedData, data + SNG_PAYLOAD_OFFSET, entry.getLength() - SNG_PAYLOAD_OFFSET);
 	}
 }
 
 
 platform PSARC::determineSngOriginalPlatform(uint8_t *data) {
-	uint64_t offset = 8;
-	uint8_t decryptedSng[16];
-	char iv[16];
-	for (int i = 0; i < 16; i++) {
-		iv[i] = data[offset++];
-	}
-	CRijndael rijndael;
-
-	rijndael.MakeKey(SngKeyPC, iv, 32, 16);
-	rijndael.Decrypt((char *)data + offset, (char *)decryptedSng, 16, CRijndael::CFB);
-//	printf("Decrypted: ");
-//	for (int i = 0; i < 16; i++) {
-//		printf("%02x ", decryptedSng[i]);
-//	}
-//	printf("\n");
+	// The payload starts with the uncompressed size and a zlib header
+	uint8_t decryptedSng[Aes256::BLOCK_SIZE];
+	SngCipherPC.ctr(data + 8, data + SNG_PAYLOAD_OFFSET, decryptedSng, Aes256::BLOCK_SIZE);
 	if (decryptedSng[4] == 0x78 && decryptedSng[5] == 0xda) {
 		return PLATFORM_PC;
 	}
-	rijndael.MakeKey(SngKeyMac, iv, 32, 16);
-	rijndael.Decrypt((char *)data + offset, (char *)decryptedSng, 16, CRijndael::CFB);
-//	printf("Decrypted: ");
-//	for (int i = 0; i < 16; i++) {
-//		printf("%02x ", decryptedSng[i]);
-//	}
-//	printf("\n");
+	SngCipherMac.ctr(data + 8, data + SNG_PAYLOAD_OFFSET, decryptedSng, Aes256::BLOCK_SIZE);
 	if (decryptedSng[4] == 0x78 && decryptedSng[5] == 0xda) {
 		return PLATFORM_MAC;
 	}
@@ -217,36 +495,92 @@ platform PSARC::determineSngOriginalPlatform(uint8_t *data) {
 
 void PSARC::parseTocEntry(Entry& entry) {
 	if (entry.getId() != 0) {
-		printf("Error: trying to parse an entry with id (%d) != 0 as TOC entry\n", entry.getId());
+		reportError("Error: trying to parse an entry with id (%d) != 0 as TOC entry", entry.getId());
 		return;
 	}
 	if (entry.getData() == NULL || entry.getLength() == 0) {
-		printf("Error: TOC data not loaded yet\n");
+		reportError("Error: TOC data not loaded yet");
 		return;
 	}
 
-	uint8_t *data = entry.getData();
-	uint64_t offset = 0;
+	m_toc.parseNames(entry.getData(), entry.getLength());
+	// TODO: Verify that all entries have a name
+}
 
-	for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
-		uint64_t nameStart = offset;
-		uint8_t byte = data[offset++];
-		uint8_t count = 1;
 
-		while ((byte != NEW_LINE) && (offset < entry.getLength())) {
-			byte = data[offset++];
-			count++;
-		}
+// Creates and returns (malloc'ed) the output directory of entry below baseDir.
+char *PSARC::makeOutputDir(Entry& entry, char *baseDir) {
+	char *subOutDirc = strdup(entry.getName());
+	char *subOutDir = dirname(subOutDirc);
+	char *outDir;
+	if (strncmp("/", entry.getName(), 1) == 0) {
+		uint32_t length = strlen(baseDir) + strlen(subOutDir) + 1;
+		outDir = (char *)malloc(length);
+		snprintf(outDir, length, "%s%s", baseDir, subOutDir);
+	} else {
+		uint32_t length = strlen(baseDir) + strlen(subOutDir) + 2;
+		outDir = (char *)malloc(length);
+		snprintf(outDir, length, "%s/%s", baseDir, subOutDir);
+	}
+	free(subOutDirc);
 
-		if (byte == NEW_LINE) {
-			char *name = strndup((char *)data + nameStart, count - 1);
-			m_entries.at(i).setName(name);
-		} else {
-			char *name = strndup((char *)data + nameStart, count);
-			m_entries.at(i).setName(name);
+	mkpath(outDir, 0777);
+	return outDir;
+}
+
+
+// Passes the data of entry to sink without loading it: blocks are inflated
+// one at a time into a single block sized buffer. Stops early when sink
+// returns false. Returns the number of bytes passed to sink.
+uint64_t PSARC::streamEntry(const Entry& entry, const std::function<bool(const uint8_t *, uint64_t)>& sink) const {
+	uint32_t cBlockSize = m_header.getBlockSizeAlloc();
+	uint32_t numBlocks = (entry.getLength() + cBlockSize - 1) / cBlockSize;
+	Buffer block = m_bufferPool->get(cBlockSize + MAX_ENCRYPTION_BLOCK_SIZE);
+	Buffer compressed = m_bufferPool->get(cBlockSize);
+	if (block.isEmpty()) {
+		reportError("Unable to allocate %d bytes for entry %d", cBlockSize, entry.getId());
+		return 0;
+	}
+	uint64_t readOffset = entry.getZOffset();
+	uint64_t written = 0;
+	for (uint32_t i = 0; i < numBlocks; i++) {
+		uint64_t blockWritten = readEntryBlock(entry, i, readOffset, NULL, compressed.data(), block.data());
+		if (blockWritten == 0 || !sink(block.data(), blockWritten))
+			break;
+		written += blockWritten;
+		uint32_t zBlockSize = m_zBlocks[entry.getZIndex() + i];
+		readOffset += (zBlockSize == 0) ? cBlockSize : zBlockSize;
+	}
+	return written;
+}
+
+
+// Writes an entry without loading it, block by block through streamEntry().
+void PSARC::extractStreamedEntryData(Entry& entry, char *baseDir) {
+	if (entry.getLength() != 0) {
+		printf("writing %i %" PRId64 " %s\n", entry.getId(), entry.getLength(), entry.getName());
+
+		char *outFilec = strdup(entry.getName());
+		char *outFile = basename(outFilec);
+		char *outDir = makeOutputDir(entry, baseDir);
+
+		File stream;
+		if (stream.open(outFile, outDir, "wb")) {
+			uint64_t writeOffset = streamEntry(entry, [&stream](const uint8_t *data, uint64_t length) {
+				stream.write((void *)data, length);
+				return true;
+			});
+			if (writeOffset != entry.getLength()) {
+				printf("File size : %" PRId64 " bytes. Expected size: %" PRId64 " bytes\n",
+					writeOffset, entry.getLength()
+				);
+			}
 		}
+		stream.close();
+
+		free(outDir);
+		free(outFilec);
 	}
-	// TODO: Verify that all entries have a name
 }
 
 
@@ -254,23 +588,9 @@ void PSARC::extractRawEntryData(Entry& entry, char *baseDir) {
 	if (entry.getLength() != 0 && entry.getData() != NULL) {
 		printf("writing %i %" PRId64 " %s\n", entry.getId(), entry.getLength(), entry.getName());
 
-		char *subOutDirc = strdup(entry.getName());
 		char *outFilec = strdup(entry.getName());
-
-		char *subOutDir = dirname(subOutDirc);
 		char *outFile = basename(outFilec);
-		char *outDir;
-		if (strncmp("/", entry.getName(), 1) == 0) {
-			uint32_t length = strlen(baseDir) + strlen(subOutDir) + 1;
-			outDir = (char *)malloc(length);
-			snprintf(outDir, length, "%s%s", baseDir, subOutDir);
-		} else {
-			uint32_t length = strlen(baseDir) + strlen(subOutDir) + 2;
-			outDir = (char *)malloc(length);
-			snprintf(outDir, length, "%s/%s", baseDir, subOutDir);
-		}
-
-		mkpath(outDir, 0777);
+		char *outDir = makeOutputDir(entry, baseDir);
 
 		File stream;
 
@@ -279,7 +599,7 @@ void PSARC::extractRawEntryData(Entry& entry, char *baseDir) {
 				stream.write(entry.getData(), entry.getLength());
 		}
 		stream.close();
-		// write decrypted
+		// write decrypted, only kept with --keep-decrypted
 		if (entry.isEncrypted() && entry.getDecryptedLength() > 0 && entry.getDecryptedData() != NULL) {
 			char decrypted[] = ".decrypted";
 			uint32_t length = strlen(outFile) + strlen(decrypted) + 1;
@@ -290,18 +610,18 @@ void PSARC::extractRawEntryData(Entry& entry, char *baseDir) {
 			}
 			stream.close();
 			free(decryptedFileName);
-			// write decompressed
-			if (entry.getDecompressedLength() > 0 && entry.getDecompressedData() != NULL) {
-				char decompressed[] = ".decompressed";
-				uint32_t length = strlen(outFile) + strlen(decompressed) + 1;
-				char *decompressedFileName = (char *)malloc(length);
-				snprintf(decompressedFileName, length, "%s%s", outFile, decompressed);
-				if (stream.open(decompressedFileName, outDir, "wb")) {
-					stream.write(entry.getDecompressedData(), entry.getDecompressedLength());
-				}
-				stream.close();
-				free(decompressedFileName);
+		}
+		// write decompressed
+		if (entry.isEncrypted() && entry.getDecompressedLength() > 0 && entry.getDecompressedData() != NULL) {
+			char decompressed[] = ".decompressed";
+			uint32_t length = strlen(outFile) + strlen(decompressed) + 1;
+			char *decompressedFileName = (char *)malloc(length);
+			snprintf(decompressedFileName, length, "%s%s", outFile, decompressed);
+			if (stream.open(decompressedFileName, outDir, "wb")) {
+				stream.write(entry.getDecompressedData(), entry.getDecompressedLength());
 			}
+			stream.close();
+			free(decompressedFileName);
 		}
 /*
 		File stream;
@@ -320,87 +640,191 @@ void PSARC::extractRawEntryData(Entry& entry, char *baseDir) {
 		stream.close();
 */
 		free(outDir);
-		free(subOutDirc);
 		free(outFilec);
 	}
 }
 
 
+// Checks that the TOC described by the header fits in the archive.
+bool PSARC::checkHeader(const char *arcName) const {
+	struct stat st;
+	if (stat(arcName, &st) != 0) {
+		return false;
+	}
+	uint64_t entriesSize = (uint64_t)m_header.getNumFiles() * m_header.getTocEntrySize();
+	return m_header.getBlockSizeAlloc() != 0 &&
+		m_header.getTocEntrySize() >= TOC_ENTRY_SIZE &&
+		m_header.getTotalTocSize() <= (uint64_t)st.st_size &&
+		Header::HEADER_SIZE + entriesSize <= m_header.getTotalTocSize();
+}
+
+
+// Checks that the blocks of every entry are in the zBlocks table, so that
+// they can be indexed without further checks.
+bool PSARC::checkEntries() const {
+	uint32_t cBlockSize = m_header.getBlockSizeAlloc();
+	for (uint32_t i = 0; i < m_toc.size(); i++) {
+		uint64_t numBlocks = (m_toc.getLength(i) + cBlockSize - 1) / cBlockSize;
+		if (m_toc.getZIndex(i) > m_zBlocks.size() || numBlocks > m_zBlocks.size() - m_toc.getZIndex(i)) {
+			reportError("Blocks of entry %d are out of range... Aborting.", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Decrypts the TOC and decodes its entries and zBlocks table.
+void PSARC::readToc() {
+	_f.seek(Header::HEADER_SIZE);
+	uint32_t realTocSize = m_header.getTotalTocSize() - Header::HEADER_SIZE;
+	std::vector<char> rawToc(m_header.getTotalTocSize());
+	const char *toc = rawToc.data();
+	if (m_header.isTocEncrypted()) {
+		const uint8_t *mappedToc = _f.map(Header::HEADER_SIZE, m_header.getTotalTocSize() & ~31);
+		if (mappedToc != NULL) {
+			// Decrypt straight out of the mapping
+			PsarcCipher.cfbDecrypt(TocIv, mappedToc, (uint8_t *)rawToc.data(), m_header.getTotalTocSize() & ~31);
+		} else {
+			std::vector<char> encryptedToc(m_header.getTotalTocSize());
+			_f.readBytes(encryptedToc.data(), realTocSize);
+			PsarcCipher.cfbDecrypt(TocIv, (const uint8_t *)encryptedToc.data(), (uint8_t *)rawToc.data(), m_header.getTotalTocSize() & ~31);
+		}
+	} else {
+		const char *mappedToc = (const char *)_f.map(Header::HEADER_SIZE, realTocSize);
+		if (mappedToc != NULL) {
+			// Parse straight out of the mapping
+			toc = mappedToc;
+		} else {
+			_f.readBytes(rawToc.data(), realTocSize);
+		}
+	}
+	uint32_t tocOffset = 0;
+	m_toc.resize(m_header.getNumFiles());
+	m_entries.reserve(m_header.getNumFiles());
+	for (uint32_t i = 0; i < m_header.getNumFiles(); i++) {
+		// Entries may be padded beyond the fields read here
+		tocOffset = i * m_header.getTocEntrySize();
+		m_toc.setMd5(i, &toc[tocOffset]);
+		tocOffset += 16;
+		m_toc.setZIndex(i, READ_BE_UINT32(&toc[tocOffset]));
+		tocOffset += 4;
+		m_toc.setLength(i, READ_BE_INT40(&toc[tocOffset]));
+		tocOffset += 5;
+		m_toc.setZOffset(i, READ_BE_INT40(&toc[tocOffset]));
+		tocOffset += 5;
+		m_entries.emplace_back(&m_toc, i);
+	}
+
+	tocOffset = m_header.getNumFiles() * m_header.getTocEntrySize();
+	uint32_t numBlocks = (m_header.getTotalTocSize() - (tocOffset + Header::HEADER_SIZE)) / m_header.getZType();
+	m_zBlocks.resize(numBlocks);
+	for (uint32_t i = 0; i < numBlocks; i++) {
+		switch (m_header.getZType()) {
+			case 2:
+				m_zBlocks[i] = READ_BE_UINT16(&toc[tocOffset]); tocOffset += 2;
+				break;
+
+			case 3:
+				m_zBlocks[i] = READ_BE_INT24(&toc[tocOffset]); tocOffset += 3;
+				break;
+
+			case 4:
+				m_zBlocks[i] = READ_BE_UINT32(&toc[tocOffset]); tocOffset += 4;
+				break;
+		}
+	}
+}
+
+
+// Takes the entries, zBlocks and names from a sidecar index instead of
+// the TOC and manifest.
+void PSARC::readIndexCache(const IndexCache& index) {
+	const IndexCacheEntry *indexEntries = index.getEntries();
+	std::vector<uint32_t> nameOffsets(index.getNumEntries());
+	m_toc.resize(index.getNumEntries());
+	m_entries.reserve(index.getNumEntries());
+	for (uint32_t i = 0; i < index.getNumEntries(); i++) {
+		m_toc.setMd5(i, indexEntries[i].md5);
+		m_toc.setZIndex(i, indexEntries[i].zIndex);
+		m_toc.setLength(i, indexEntries[i].length);
+		m_toc.setZOffset(i, indexEntries[i].zOffset);
+		nameOffsets[i] = indexEntries[i].nameOffset;
+		m_entries.emplace_back(&m_toc, i);
+	}
+	m_toc.setNames(index.getNames(), index.getNamesSize(), nameOffsets.data());
+	m_zBlocks.assign(index.getZBlocks(), index.getZBlocks() + index.getNumBlocks());
+}
+
+
 bool PSARC::read(const char *arcName) {
-	char *dirNamec = strdup(arcName);
-	char *fileNamec = strdup(arcName);
+	close();
 
-	char *dirName = dirname(dirNamec);
-	char *fileName = basename(fileNamec);
+	// dirname() and basename() may modify their argument
+	std::string dirNamec(arcName);
+	std::string fileNamec(arcName);
 
-	if (_f.open(fileName, dirName)) {
-		m_header.setMagicNumber(_f.readUint32BE(_buffer));
+	char *dirName = dirname(&dirNamec[0]);
+	char *fileName = basename(&fileNamec[0]);
+
+	if (_f.open(fileName, dirName, "rb", m_options.fileBackend)) {
+		uint8_t headerField[4];
+		m_header.setMagicNumber(_f.readUint32BE(headerField));
 		if (m_header.isPSARC()) {
-			m_header.setVersionNumber(_f.readUint32BE(_buffer));
-			m_header.setCompressionMethod(_f.readUint32BE(_buffer));
-			m_header.setTotalTocSize(_f.readUint32BE(_buffer));
-			m_header.setTocEntrySize(_f.readUint32BE(_buffer));
-			m_header.setNumFiles(_f.readUint32BE(_buffer));
-			m_header.setBlockSizeAlloc(_f.readUint32BE(_buffer));
-			m_header.setArchiveFlags(_f.readUint32BE(_buffer));
-
-			if (m_header.isZlib()) {
+			m_header.setVersionNumber(_f.readUint32BE(headerField));
+			m_header.setCompressionMethod(_f.readUint32BE(headerField));
+			m_header.setTotalTocSize(_f.readUint32BE(headerField));
+			m_header.setTocEntrySize(_f.readUint32BE(headerField));
+			m_header.setNumFiles(_f.readUint32BE(headerField));
+			m_header.setBlockSizeAlloc(_f.readUint32BE(headerField));
+			m_header.setArchiveFlags(_f.readUint32BE(headerField));
+
+			Codec *lzmaCodec = m_header.isLzma() ? Codec::get("lzma") : NULL;
+			if (!checkHeader(arcName)) {
+				reportError("Invalid table of contents... Aborting.");
+				return false;
+			} else if (m_header.isZlib() || lzmaCodec != NULL) {
+				if (lzmaCodec != NULL) {
+					m_codec = lzmaCodec;
+				}
+				// LZMA and verifying are slow enough to use all cores unless told otherwise
+				m_threads = m_options.threads;
+				if (m_threads == 0) {
+					m_threads = (m_header.isLzma() || m_options.verify) ? std::thread::hardware_concurrency() : 1;
+				}
+				if (m_pool != NULL && !m_ownsPool) {
+					// Shared with other archives
+					m_threads = m_pool->getNumThreads();
+				} else if (m_threads > 1 && m_pool == NULL) {
+					m_pool = new ThreadPool(m_threads);
+					m_ownsPool = true;
+				}
+
 				m_header.setZType(1);
 				for (uint64_t i = 0x100; i < m_header.getBlockSizeAlloc(); i <<= 8) {
 					m_header.setZType(m_header.getZType() + 1);
 				}
 
-				_f.seek(Header::HEADER_SIZE);
-				uint32_t realTocSize = m_header.getTotalTocSize() - Header::HEADER_SIZE;
-				char rawToc[m_header.getTotalTocSize()];
-				if (m_header.isTocEncrypted()) {
-					char encryptedToc[m_header.getTotalTocSize()];
-					_f.readBytes(encryptedToc, realTocSize);
-					CRijndael rijndael;
-
-					rijndael.MakeKey(PsarcKey, CRijndael::sm_chain0, 32, 16);
-  				rijndael.Decrypt(encryptedToc, rawToc, m_header.getTotalTocSize() & ~31, CRijndael::CFB);
+				IndexCacheKey key;
+				uint8_t rawHeader[Header::HEADER_SIZE];
+				IndexCache index;
+				bool useIndex = m_options.indexCache && _f.readAt(0, rawHeader, Header::HEADER_SIZE) &&
+					IndexCache::makeKey(arcName, rawHeader, &key);
+				bool indexed = useIndex && index.open(arcName, key) && index.getNumEntries() == m_header.getNumFiles();
+				if (indexed) {
+					readIndexCache(index);
 				} else {
-					_f.readBytes(rawToc, realTocSize);
+					readToc();
 				}
-				uint32_t tocOffset = 0;
-				m_entries.reserve(m_header.getNumFiles());
-				for (uint32_t i = 0; i < m_header.getNumFiles(); i++) {
-					Entry entry = Entry(i);
-					char md5[16];
-					for (int j = 0; j < 16; j++) {
-						md5[j] = rawToc[tocOffset++];
-					}
-					entry.setMd5(md5);
-					entry.setZIndex(READ_BE_UINT32(&rawToc[tocOffset]));
-					tocOffset += 4;
-					entry.setLength(READ_BE_INT40(&rawToc[tocOffset]));
-					tocOffset += 5;
-					entry.setZOffset(READ_BE_INT40(&rawToc[tocOffset]));
-					tocOffset += 5;
-					m_entries.push_back(entry);
-				}
-
-				uint32_t numBlocks = (m_header.getTotalTocSize() - (tocOffset + Header::HEADER_SIZE)) / m_header.getZType();
-				uint32_t *zBlocks = new uint32_t[numBlocks];
-				for (uint32_t i = 0; i < numBlocks; i++) {
-					switch (m_header.getZType()) {
-						case 2:
-							zBlocks[i] = READ_BE_UINT16(&rawToc[tocOffset]); tocOffset += 2;
-							break;
-
-						case 3:
-							zBlocks[i] = READ_BE_INT24(&rawToc[tocOffset]); tocOffset += 3;
-							break;
-
-						case 4:
-							zBlocks[i] = READ_BE_UINT32(&rawToc[tocOffset]); tocOffset += 4;
-							break;
-					}
+				index.close();
+				if (!checkEntries()) {
+					return false;
 				}
 
 				char ext[] = ".psarc";
-				if (strlen(fileName) >= 6 && strncmp(fileName + strlen(fileName) - strlen(ext), ext, strlen(ext)) == 0) {
+				if (m_options.outputDir != NULL) {
+					baseDir = strdup(m_options.outputDir);
+				} else if (strlen(fileName) >= 6 && strncmp(fileName + strlen(fileName) - strlen(ext), ext, strlen(ext)) == 0) {
 					baseDir = (char *)malloc(strlen(fileName) - strlen(ext) + 1);
 					snprintf(baseDir, strlen(fileName) - strlen(ext) + 1, "%s", fileName);
 				} else {
@@ -410,23 +834,22 @@ bool PSARC::read(const char *arcName) {
 					snprintf(baseDir, strlen(fileName) + strlen(data) + 1, "%s%s", fileName, data);
 				}
 
-				for (uint32_t i = 0; i < m_header.getNumFiles(); i++) {
-					readEntry(m_entries.at(i), zBlocks, m_header.getBlockSizeAlloc());
-					if (i == 0) {
-						parseTocEntry(m_entries.at(0));
-					} else {
-						decryptEntry(m_entries.at(i));
+				// Only the file names are read here, the data of the other
+				// entries is read on first access through loadEntry().
+				if (!indexed && m_header.getNumFiles() > 0) {
+					// A name list that failed to load is not worth caching
+					bool namesLoaded = loadEntry(m_entries.at(0));
+					if (useIndex && namesLoaded && !IndexCache::write(arcName, key, m_toc, m_zBlocks) && m_options.verbose_flag) {
+						printf("Unable to write the index of %s\n", arcName);
 					}
 				}
-
-				delete[] zBlocks;
 				return true;
 			} else {
-				printf("Compression type is not zlib... Aborting.");
+				reportError("Compression type is not zlib%s... Aborting.", Codec::get("lzma") != NULL ? " or lzma" : "");
 				return false;
 			}
 		} else {
-			printf("Is not a PSARC file... Aborting.");
+			reportError("Is not a PSARC file... Aborting.");
 			return false;
 		}
 		return true;
@@ -441,8 +864,12 @@ void PSARC::writeBlock(File& stream, uint8_t *dataToWrite, uint8_t *zBlocks, uin
 	//   write block size to zBlock data/TOC space
 	// TODO Attempt to gzip block
 	uint8_t *zipBuffer = (uint8_t *)malloc(blockSize);
-	uLongf zipBufferSize = blockSize;
-	if (compress2(zipBuffer, &zipBufferSize, dataToWrite, blockSize, Z_BEST_COMPRESSION) == Z_OK) {
+	uint64_t zipBufferSize = blockSize;
+	if (m_header.isLzma()) {
+		// A LZMA block as big as the input would be read back as stored
+		zipBufferSize = (blockSize > 0) ? blockSize - 1 : 0;
+	}
+	if (m_codec->compress(zipBuffer, &zipBufferSize, dataToWrite, blockSize, m_header.isLzma() ? LZMA_PRESET : Z_BEST_COMPRESSION)) {
 		// Write compressed block
 		stream.write(zipBuffer, zipBufferSize);
 		switch (m_header.getZType()) {
@@ -501,6 +928,17 @@ bool PSARC::write(Options& options) {
 		uint8_t *tocBuffer = (uint8_t *)malloc(64 * 1024);
 		// Write data
 		printf("Should write some data\n");
+		for (uint32_t i = 0; i < m_header.getNumFiles(); i++) {
+			loadEntry(m_entries.at(i));
+		}
+		// Switch compression only once everything is read with the input's
+		if (options.outputCompression == Header::COMPRESSION_LZMA && !m_header.isLzma()) {
+			m_header.setCompressionMethod(Header::COMPRESSION_LZMA);
+			m_codec = Codec::get("lzma");
+		} else if (options.outputCompression == Header::COMPRESSION_ZLIB && !m_header.isZlib()) {
+			m_header.setCompressionMethod(Header::COMPRESSION_ZLIB);
+			m_codec = Codec::getZlib(m_options.codecName);
+		}
 		// TODO Encrypt files to data areas and get new file lengths (just in case)
 		if (options.targetPlatform != PLATFORM_NONE) {
 			for (int i = 1; i < m_header.getNumFiles(); i++) {
@@ -579,7 +1017,7 @@ bool PSARC::write(Options& options) {
 		for (int i = 0; i < m_header.getNumFiles(); i++) {
 			Entry& entry = m_entries.at(i);
 			for (int j = 0; j < 16; j++) {
-				tocBuffer[tocOffset++ + j] = entry.getMd5()[j];
+				tocBuffer[tocOffset++] = entry.getMd5()[j];
 			}
 			WRITE_BE_UINT32(tocBuffer + tocOffset, entry.getZIndex()); tocOffset += 4;
 			WRITE_BE_INT40(tocBuffer + tocOffset, entry.getLength()); tocOffset += 5;
@@ -590,10 +1028,7 @@ bool PSARC::write(Options& options) {
 			// TODO encrypt header
 			printf("encrypt toc\n");
 			char encryptedToc[m_header.getTotalTocSize()];
-			CRijndael rijndael;
-
-			rijndael.MakeKey(PsarcKey, CRijndael::sm_chain0, 32, 16);
-			rijndael.Encrypt((const char *)tocBuffer + 32, encryptedToc, m_header.getTotalTocSize() & ~31, CRijndael::CFB);
+			PsarcCipher.cfbEncrypt(TocIv, tocBuffer + 32, (uint8_t *)encryptedToc, m_header.getTotalTocSize() & ~31);
 			for (int i = 0; i < 32; i++) {
 				printf("%02x ", (uint8_t)encryptedToc[i]);
 			}
@@ -627,25 +1062,272 @@ void PSARC::setNewAppId(const char *newAppId) {
 	for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
 		if (strcmp(m_entries.at(i).getName(), "appid.appid") == 0) {
 			printf("entry %d is appid.appid\n", i);
-			char *newData = new char[strlen(newAppId)];
-			for (int i = 0; i < strlen(newAppId); i++) {
-				newData[i] = newAppId[i];
-			}
-			free(m_entries.at(i).getName());
-			m_entries.at(i).setName(newData);
+			Buffer newData = m_bufferPool->get(strlen(newAppId));
+			memcpy(newData.data(), newAppId, strlen(newAppId));
+			newData.setSize(strlen(newAppId));
+			m_entries.at(i).setData(std::move(newData));
 			m_entries.at(i).setLength(strlen(newAppId));
 		}
 	}
 }
 
 
+// Extraction with the read, inflate, decrypt and write steps running as
+// separate stages connected by bounded queues, so at most about
+// 3 * PIPELINE_QUEUE_DEPTH entries are held in memory at any time.
+void PSARC::extractAllFilesPipelined() {
+	struct Item {
+		Entry *entry;
+		Buffer compressed; // copy of the compressed blocks when not mapped
+		const uint8_t *src;
+	};
+	BoundedQueue<Item> inflateQueue(PIPELINE_QUEUE_DEPTH);
+	BoundedQueue<Item> decryptQueue(PIPELINE_QUEUE_DEPTH);
+	BoundedQueue<Item> writeQueue(PIPELINE_QUEUE_DEPTH);
+
+	std::vector<std::thread> inflaters;
+	for (uint32_t i = 0; i < m_threads; i++) {
+		inflaters.push_back(std::thread([this, &inflateQueue, &decryptQueue]() {
+			Item item;
+			while (inflateQueue.pop(item)) {
+				readEntry(*item.entry, item.src);
+				item.compressed.release();
+				item.src = NULL;
+				decryptQueue.push(std::move(item));
+			}
+		}));
+	}
+	std::thread decrypter([this, &decryptQueue, &writeQueue]() {
+		Item item;
+		while (decryptQueue.pop(item)) {
+			decryptEntry(*item.entry);
+			item.entry->setLoaded(true);
+			writeQueue.push(std::move(item));
+		}
+	});
+	std::thread writer([this, &writeQueue]() {
+		Item item;
+		while (writeQueue.pop(item)) {
+			extractRawEntryData(*item.entry, baseDir);
+			item.entry->releaseData();
+		}
+	});
+
+	// Read stage
+	for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
+		if (!isSelected(i)) {
+			continue;
+		}
+		Item item;
+		item.entry = &m_entries.at(i);
+		item.src = NULL;
+		if (item.entry->isLoaded() || item.entry->getData() != NULL) {
+			loadEntry(*item.entry);
+			writeQueue.push(std::move(item));
+			continue;
+		}
+		uint64_t compressedLength = getCompressedLength(*item.entry);
+		if (compressedLength > 0) {
+			item.src = _f.map(item.entry->getZOffset(), compressedLength);
+			if (item.src == NULL) {
+				item.compressed = m_bufferPool->get(compressedLength);
+				if (item.compressed.isEmpty() || !_f.readAt(item.entry->getZOffset(), item.compressed.data(), compressedLength)) {
+					reportError("Unable to read entry %d", item.entry->getId());
+					continue;
+				}
+				item.compressed.setSize(compressedLength);
+				item.src = item.compressed.data();
+			}
+		}
+		inflateQueue.push(std::move(item));
+	}
+
+	inflateQueue.close();
+	for (size_t i = 0; i < inflaters.size(); i++) {
+		inflaters[i].join();
+	}
+	decryptQueue.close();
+	decrypter.join();
+	writeQueue.close();
+	writer.join();
+}
+
+
+// Extraction with every entry as a task on a thread pool shared with
+// other archives, so idle threads pick up entries of whichever archive
+// still has work.
+void PSARC::extractAllFilesTasks() {
+	TaskGroup group;
+	for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
+		if (!isSelected(i)) {
+			continue;
+		}
+		Entry *entry = &m_entries.at(i);
+		m_pool->run(group, [this, entry]() {
+			extractEntryData(*entry);
+		});
+	}
+	m_pool->wait(group);
+}
+
+
+// Applies the --include/--exclude patterns to the name of entry. Names
+// match when no include pattern is given.
+bool PSARC::isSelected(uint32_t id) const {
+	const char *name = m_toc.getName(id);
+	if (name == NULL) {
+		return false;
+	}
+	bool included = m_options.includePatterns.empty();
+	for (size_t i = 0; i < m_options.includePatterns.size() && !included; i++) {
+		included = fnmatch(m_options.includePatterns[i], name, 0) == 0;
+	}
+	for (size_t i = 0; i < m_options.excludePatterns.size() && included; i++) {
+		included = fnmatch(m_options.excludePatterns[i], name, 0) != 0;
+	}
+	return included;
+}
+
+
+// Writes a single entry to baseDir and releases its data.
+void PSARC::extractEntryData(Entry& entry) {
+	// Encrypted .sng files need their whole data for decryption, they are
+	// small enough to be loaded even when streaming.
+	if (m_options.streamExtract && !entry.hasExtension(".sng") && !entry.isLoaded()) {
+		extractStreamedEntryData(entry, baseDir);
+	} else {
+		loadEntry(entry);
+		extractRawEntryData(entry, baseDir);
+		entry.releaseData();
+	}
+}
+
+
+Entry *PSARC::findEntry(const char *name) {
+	uint32_t id = m_toc.find(name);
+	if (id == Toc::NO_ENTRY) {
+		return NULL;
+	}
+	return &m_entries.at(id);
+}
+
+
+bool PSARC::extractEntry(const char *name) {
+	Entry *entry = findEntry(name);
+	if (entry == NULL) {
+		printf("No entry named '%s'\n", name);
+		return false;
+	}
+	extractEntryData(*entry);
+	return true;
+}
+
+
 void PSARC::extractAllFiles() {
+	if (m_options.streamExtract) {
+		for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
+			if (isSelected(i)) {
+				extractEntryData(m_entries.at(i));
+			}
+		}
+		return;
+	}
+	if (m_pool != NULL && !m_ownsPool) {
+		extractAllFilesTasks();
+		return;
+	}
+	if (m_threads > 1) {
+		extractAllFilesPipelined();
+		return;
+	}
+	uint32_t readEnd = 1;
 	for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
-		extractRawEntryData(m_entries.at(i), baseDir);
+		Entry& entry = m_entries.at(i);
+		if (!isSelected(entry.getId())) {
+			continue;
+		}
+		if (i >= readEnd && m_options.fileBackend == FILE_BACKEND_URING) {
+			readEnd = readEntries(i);
+		}
+		extractEntryData(entry);
 	}
 }
 
 
+// Checks the names against the MD5 hashes in the TOC and that every block
+// can be read and decompresses to the expected length. Entries are
+// handed out to the threads one at a time and only one block is held per
+// thread. Returns false when an entry is corrupt.
+bool PSARC::verify() {
+	uint32_t numFiles = m_header.getNumFiles();
+	uint32_t cBlockSize = m_header.getBlockSizeAlloc();
+	std::vector<std::string> errors(numFiles);
+	std::atomic<uint32_t> next(0);
+
+	auto verifyEntries = [this, &errors, &next, numFiles, cBlockSize]() {
+		Buffer buffer = m_bufferPool->get(cBlockSize);
+		Buffer out = m_bufferPool->get(cBlockSize);
+		for (uint32_t i = next++; i < numFiles; i = next++) {
+			const Entry& entry = m_entries[i];
+			if (out.isEmpty()) {
+				errors[i] = "out of memory";
+				continue;
+			}
+			if (i > 0) {
+				uint8_t md5[Md5::DIGEST_SIZE];
+				if (entry.getName() == NULL) {
+					errors[i] = "no name in the manifest";
+					continue;
+				}
+				Md5::digest(entry.getName(), strlen(entry.getName()), md5);
+				if (memcmp(md5, entry.getMd5(), Md5::DIGEST_SIZE) != 0) {
+					errors[i] = "name does not match the MD5 in the TOC";
+					continue;
+				}
+			}
+
+			uint64_t numBlocks = (entry.getLength() + cBlockSize - 1) / cBlockSize;
+			uint64_t readOffset = entry.getZOffset();
+			for (uint32_t block = 0; block < numBlocks; block++) {
+				uint64_t expected = entry.getLength() - (uint64_t)block * cBlockSize;
+				if (expected > cBlockSize) {
+					expected = cBlockSize;
+				}
+				if (readEntryBlock(entry, block, readOffset, NULL, buffer.data(), out.data()) != expected) {
+					char error[64];
+					snprintf(error, sizeof(error), "block %d does not decompress to %" PRId64 " bytes", block, expected);
+					errors[i] = error;
+					break;
+				}
+				uint32_t zBlockSize = m_zBlocks[entry.getZIndex() + block];
+				readOffset += (zBlockSize == 0) ? cBlockSize : zBlockSize;
+			}
+		}
+	};
+
+	if (m_pool != NULL) {
+		TaskGroup group;
+		for (uint32_t task = 0; task < m_pool->getNumThreads(); task++) {
+			m_pool->run(group, verifyEntries);
+		}
+		m_pool->wait(group);
+	} else {
+		verifyEntries();
+	}
+
+	uint32_t corrupt = 0;
+	for (uint32_t i = 0; i < numFiles; i++) {
+		if (!errors[i].empty()) {
+			const char *name = (i == 0) ? "(manifest)" : m_entries[i].getName();
+			printf("%d %s: %s\n", i, name != NULL ? name : "", errors[i].c_str());
+			corrupt++;
+		}
+	}
+	printf("%d entries verified, %d corrupt\n", numFiles, corrupt);
+	return corrupt == 0;
+}
+
+
 void PSARC::displayHeader() {
 	printf("Header:\n");
 	printf("\tmagicNumber:       %08x\n", m_header.getMagicNumber());
@@ -660,8 +1342,10 @@ void PSARC::displayHeader() {
 
 
 void PSARC::displayFileList() {
-	for (uint32_t i = 1; i < m_header.getNumFiles(); i++) {
-		Entry &entry = m_entries.at(i);
-		printf("%d %" PRId64 "b %s\n", entry.getId(), entry.getLength(), entry.getName());
+	for (uint32_t i = 1; i < m_toc.size(); i++) {
+		if (!isSelected(i)) {
+			continue;
+		}
+		printf("%d %" PRId64 "b %s\n", i, m_toc.getLength(i), m_toc.getName(i));
 	}
 }
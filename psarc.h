@@ -6,41 +6,99 @@
 #ifndef PSARC_H__
 #define PSARC_H__
 
+#include <functional>
+#include <string>
 #include <vector>
+#include "aes.h"
+#include "buffer.h"
+#include "codec.h"
 #include "file.h"
+#include "index_cache.h"
 #include "options.h"
 #include "psarc_header.h"
 #include "psarc_entry.h"
+#include "psarc_toc.h"
+#include "thread_pool.h"
 
 
 class PSARC {
 public:
 	PSARC();
+	// The thread and buffer pools may be shared with other PSARCs, by
+	// default each PSARC makes its own.
+	PSARC(const Options& options, ThreadPool *pool = NULL, BufferPool *bufferPool = NULL);
 	~PSARC();
 
 	bool read(const char *arcName);
+	void close();
+	bool loadEntry(Entry& entry);
+	// Returns the entry called name (as listed), or NULL.
+	Entry *findEntry(const char *name);
+	const Entry& getEntry(uint32_t id) const { return m_entries[id]; }
+	bool extractEntry(const char *name);
+	uint64_t streamEntry(const Entry& entry, const std::function<bool(const uint8_t *, uint64_t)>& sink) const;
+	uint64_t getCompressedLength(const Entry& entry) const;
+	const Toc& getToc() const { return m_toc; }
+	// Errors met while reading go to handler instead of stdout. It may be
+	// called from several threads at once.
+	void setErrorHandler(const std::function<void(const char *)>& handler) { m_errorHandler = handler; }
 	void displayHeader();
 	void displayFileList();
 	void extractAllFiles();
+	bool verify();
 	bool write(Options& options);
 
 private:
 	static const uint8_t NEW_LINE = 0x0a;
+	static const uint32_t TOC_ENTRY_SIZE = 30;
+	static const uint32_t READ_BATCH_ENTRIES = 64;
+	static const uint64_t READ_BATCH_BYTES = 8 * 1024 * 1024;
+	static const uint32_t PARALLEL_MIN_BLOCKS = 4;
+	static const uint32_t PARALLEL_MIN_BLOCKS_LZMA = 2;
+	static const int LZMA_PRESET = 6;
+	static const uint32_t PIPELINE_QUEUE_DEPTH = 8;
+	static const uint64_t PARALLEL_CIPHER_CHUNK = 1024 * 1024;
+	static const uint64_t SNG_STREAM_CHUNK = 64 * 1024;
 
-	void readEntry(Entry& entry, uint32_t *zBlocks, uint32_t cBlockSize);
+	const uint8_t *readBlock(uint64_t offset, uint32_t size, uint8_t *buffer) const;
+	uint64_t readEntryBlock(const Entry& entry, uint32_t block, uint64_t readOffset, const uint8_t *src, uint8_t *buffer, uint8_t *out) const;
+	bool readEntry(Entry& entry, const uint8_t *src = NULL);
+	uint32_t readEntries(uint32_t first);
+	void reportError(const char *format, ...) const __attribute__((format(printf, 2, 3)));
+	bool checkHeader(const char *arcName) const;
+	bool checkEntries() const;
+	void readToc();
+	void readIndexCache(const IndexCache& index);
 	void parseTocEntry(Entry& entry);
+	char *makeOutputDir(Entry& entry, char *baseDir);
 	void extractRawEntryData(Entry& entry, char *baseDir);
+	void extractStreamedEntryData(Entry& entry, char *baseDir);
+	void extractEntryData(Entry& entry);
+	bool isSelected(uint32_t id) const;
+	void extractAllFilesPipelined();
+	void extractAllFilesTasks();
+	void sngCipher(const Aes256& aes, const uint8_t *iv, const uint8_t *in, uint8_t *out, uint64_t length) const;
 	void decryptEntry(Entry& entry);
+	void inflateSngStreamed(Entry& entry, const Aes256& aes);
 	void encryptEntry(Entry& entry, platform targetPlatform);
 	platform determineSngOriginalPlatform(uint8_t *data);
 	void setNewAppId(const char *newAppId);
 	void writeBlock(File& stream, uint8_t *dataToWrite, uint8_t *zBlocks, uint32_t zBlock, uint64_t *zOffset, uint32_t blockSize);
 
 	File _f;
-	uint8_t *_buffer;
+	Options m_options;
+	BufferPool m_ownBufferPool;
+	BufferPool *m_bufferPool;
+	uint32_t m_threads;
+	ThreadPool *m_pool;
+	bool m_ownsPool;
+	Codec *m_codec;
+	std::function<void(const char *)> m_errorHandler;
 
 	Header m_header;
+	Toc m_toc;
 	std::vector<Entry> m_entries;
+	std::vector<uint32_t> m_zBlocks;
 	char *baseDir;
 };
 
@@ -1,99 +1,99 @@
 #ifndef PSARC_ENTRY_H__
 #define PSARC_ENTRY_H__
 
+#include <memory>
+#include <utility>
+#include "buffer.h"
 #include "psarc_platform.h"
+#include "psarc_toc.h"
 
 
+// An entry of the archive: its TOC fields live in the Toc, the entry
+// itself only holds a handle to the data read so far, allocated when the
+// entry is loaded. Entries can be moved but not copied.
 class Entry {
 public:
-  Entry(uint32_t id)
-    : id(id)
-    , length(0)
-    , name(NULL)
-    , zIndex(0)
-    , zOffset(0)
-    , data(NULL)
-    , encrypted(false)
-    , originalPlatform(PLATFORM_NONE)
-    , decryptedLength(0)
-    , decryptedData(NULL)
-    , decompressedLength(0)
-    , decompressedData(NULL)
+  Entry(Toc *toc, uint32_t id)
+    : toc(toc)
+    , id(id)
     {}
 
-  ~Entry() {
-     if (data != NULL) {
-       delete data;
-       data = NULL;
-     }
-     if (decryptedData != NULL) {
-       delete decryptedData;
-       decryptedData = NULL;
-     }
-     if (decompressedData != NULL) {
-       delete decompressedData;
-       decompressedData = NULL;
-     }
-  }
+  Entry(Entry&&) = default;
+  Entry& operator=(Entry&&) = default;
 
   uint32_t getId() const { return id; }
   void setId(uint32_t id) { this->id = id; }
 
-  uint64_t getLength() const { return length; }
-  void setLength(uint64_t length) { this->length = length; }
+  uint64_t getLength() const { return toc->getLength(id); }
+  void setLength(uint64_t length) { toc->setLength(id, length); }
 
-  char* getName() const { return name; }
-  void setName(char *name) { this->name = name; }
-  bool hasExtension(const char *extension) {
-		return (strlen(name) >= strlen(extension) &&
-     strncmp(name + strlen(name) - strlen(extension), extension, strlen(extension)) == 0
+  const char* getName() const { return toc->getName(id); }
+  bool hasExtension(const char *extension) const {
+    uint32_t nameLength = toc->getNameLength(id);
+		return (getName() != NULL && nameLength >= strlen(extension) &&
+     strncmp(getName() + nameLength - strlen(extension), extension, strlen(extension)) == 0
    );
   }
 
-  uint32_t getZIndex() const { return zIndex; }
-  void setZIndex(uint32_t zIndex) { this->zIndex = zIndex; }
+  uint32_t getZIndex() const { return toc->getZIndex(id); }
+  void setZIndex(uint32_t zIndex) { toc->setZIndex(id, zIndex); }
 
-  uint64_t getZOffset() const { return zOffset; }
-  void setZOffset(uint64_t zOffset) { this->zOffset = zOffset; }
+  uint64_t getZOffset() const { return toc->getZOffset(id); }
+  void setZOffset(uint64_t zOffset) { toc->setZOffset(id, zOffset); }
 
-  char const* getMd5() const { return md5; }
-  void setMd5(char* md5) { for (int i = 0; i < 16; i++) this->md5[i] = md5[i]; }
+  char const* getMd5() const { return toc->getMd5(id); }
+  void setMd5(const char* md5) { toc->setMd5(id, md5); }
 
-  uint8_t* getData() const { return data; }
-  void setData(uint8_t* data) { this->data = data; }
+  uint8_t* getData() const { return payload ? payload->data.data() : NULL; }
+  Buffer& getDataBuffer() { return getPayload().data; }
+  void setData(Buffer&& data) { getPayload().data = std::move(data); }
 
-  bool isEncrypted() const { return encrypted; }
-  void setEncrypted(bool encrypted) { this->encrypted = encrypted; }
+  bool isEncrypted() const { return payload && payload->encrypted; }
+  void setEncrypted(bool encrypted) { getPayload().encrypted = encrypted; }
 
-  platform getOriginalPlatform() const { return originalPlatform; }
-  void setOriginalPlatform(platform originalPlatform) { this->originalPlatform = originalPlatform; }
+  platform getOriginalPlatform() const { return payload ? payload->originalPlatform : PLATFORM_NONE; }
+  void setOriginalPlatform(platform originalPlatform) { getPayload().originalPlatform = originalPlatform; }
 
-  uint64_t getDecryptedLength() const { return decryptedLength; }
-  void setDecryptedLength(uint64_t decryptedLength) { this->decryptedLength = decryptedLength; }
+  uint64_t getDecryptedLength() const { return payload ? payload->decryptedData.size() : 0; }
+  uint8_t* getDecryptedData() const { return payload ? payload->decryptedData.data() : NULL; }
+  void setDecryptedData(Buffer&& decryptedData) { getPayload().decryptedData = std::move(decryptedData); }
 
-  uint8_t* getDecryptedData() const { return decryptedData; }
-  void setDecryptedData(uint8_t *decryptedData) { this->decryptedData = decryptedData; }
+  uint64_t getDecompressedLength() const { return payload ? payload->decompressedData.size() : 0; }
+  uint8_t *getDecompressedData() const { return payload ? payload->decompressedData.data() : NULL; }
+  void setDecompressedData(Buffer&& decompressedData) { getPayload().decompressedData = std::move(decompressedData); }
 
-  uint64_t getDecompressedLength() const { return decompressedLength; }
-  void setDecompressedLength(uint64_t decompressedLength) { this->decompressedLength = decompressedLength; }
+  bool isLoaded() const { return payload && payload->loaded; }
+  void setLoaded(bool loaded) { getPayload().loaded = loaded; }
 
-  uint8_t *getDecompressedData() const { return decompressedData; }
-  void setDecompressedData(uint8_t *decompressedData) { this->decompressedData = decompressedData; }
+  // Frees the data buffers, the entry is read again on next access.
+  void releaseData() { payload.reset(); }
 
 private:
-	uint32_t id;
-	uint64_t length;
-	char *name;
-	uint32_t zIndex;
-	uint64_t zOffset;
-	char md5[16];
-	uint8_t *data;
-  bool encrypted;
-  platform originalPlatform;
-  uint64_t decryptedLength;
-  uint8_t *decryptedData;
-  uint16_t decompressedLength;
-  uint8_t *decompressedData;
+  // What an entry holds once it was read
+  struct Payload {
+    Payload() : encrypted(false), originalPlatform(PLATFORM_NONE), loaded(false) {}
+
+    Buffer data;
+    bool encrypted;
+    platform originalPlatform;
+    Buffer decryptedData;
+    Buffer decompressedData;
+    bool loaded;
+  };
+
+  Entry(const Entry&);
+  Entry& operator=(const Entry&);
+
+  Payload& getPayload() {
+    if (!payload) {
+      payload.reset(new Payload);
+    }
+    return *payload;
+  }
+
+  Toc *toc;
+  uint32_t id;
+  std::unique_ptr<Payload> payload;
 };
 
 #endif // PSARC_ENTRY_H__
@@ -0,0 +1,61 @@
+#include "psarc_keys.h"
+
+
+const uint32_t PsarcKeySchedule[Aes256::SCHEDULE_WORDS] =
+{
+	0xc53db238, 0x70a1a2f7, 0x1cae6406, 0x1fdd0e11,
+	0x57309dc8, 0x5204d4c5, 0xbfdf2509, 0x0df2572c,
+	0x4d66c3ef, 0x3dc76118, 0x2169051e, 0x3eb40b0f,
+	0xe5bdb6be, 0xb7b9627b, 0x08664772, 0x0594105e,
+	0x6dac9b84, 0x506bfa9c, 0x7102ff82, 0x4fb6f48d,
+	0x61f309e3, 0xd64a6b98, 0xde2c2cea, 0xdbb83cb4,
+	0x0547163d, 0x552ceca1, 0x242e1323, 0x6b98e7ae,
+	0x1eb59d07, 0xc8fff69f, 0x16d3da75, 0xcd6be6c1,
+	0x72c96e80, 0x27e58221, 0x03cb9102, 0x685376ac,
+	0x5b58a596, 0x93a75309, 0x8574897c, 0x481f6fbd,
+	0xa26114d2, 0x858496f3, 0x864f07f1, 0xee1c715d,
+	0x73c406da, 0xe06355d3, 0x6517dcaf, 0x2d08b312,
+	0xb20cdd0a, 0x37884bf9, 0xb1c74c08, 0x5fdb3d55,
+	0xbc7d2126, 0x5c1e74f5, 0x3909a85a, 0x14011b48,
+	0x8ea38ff0, 0xb92bc409, 0x08ec8801, 0x5737b554
+};
+
+
+const uint32_t SngKeyMacSchedule[Aes256::SCHEDULE_WORDS] =
+{
+	0x9821330e, 0x34b91f70, 0xd0a48cbd, 0x62599312,
+	0x6970cea0, 0x9192c0e6, 0xcda676cc, 0x9838289d,
+	0x9e156d48, 0xaaac7238, 0x7a08fe85, 0x18516d97,
+	0xc4a1f228, 0x553332ce, 0x98954402, 0x00ad6c9f,
+	0x0945b62b, 0xa3e9c413, 0xd9e13a96, 0xc1b05701,
+	0xbc46a954, 0xe9759b9a, 0x71e0df98, 0x714db307,
+	0xee287388, 0x4dc1b79b, 0x94208d0d, 0x5590da0c,
+	0x4026feaa, 0xa9536530, 0xd8b3baa8, 0xa9fe09af,
+	0x5d290a5b, 0x10e8bdc0, 0x84c830cd, 0xd158eac1,
+	0x7e4c79d2, 0xd71f1ce2, 0x0faca64a, 0xa652afe5,
+	0x4d50d37f, 0x5db86ebf, 0xd9705e72, 0x0828b4b3,
+	0x4e78f4bf, 0x9967e85d, 0x96cb4e17, 0x3099e1f2,
+	0x83a85a7b, 0xde1034c4, 0x07606ab6, 0x0f48de05,
+	0x382ae9d4, 0xa14d0189, 0x37864f9e, 0x071fae6c,
+	0x034c0abe, 0xdd5c3e7a, 0xda3c54cc, 0xd5748ac9
+};
+
+
+const uint32_t SngKeyPCSchedule[Aes256::SCHEDULE_WORDS] =
+{
+	0xcb648df3, 0xd12a16bf, 0x71701414, 0xe69619ec,
+	0x171cca5d, 0x2a142e3e, 0x59de7add, 0xa18a3a30,
+	0xb4e489c1, 0x65ce9f7e, 0x14be8b6a, 0xf2289286,
+	0x9e288519, 0xb43cab27, 0xede2d1fa, 0x4c68ebca,
+	0xf30dfde8, 0x96c36296, 0x827de9fc, 0x70557b7a,
+	0xcfd4a4c3, 0x7be80fe4, 0x960ade1e, 0xda6235d4,
+	0x5d9bb5bf, 0xcb58d729, 0x49253ed5, 0x397045af,
+	0xdd85caba, 0xa66dc55e, 0x30671b40, 0xea052e94,
+	0x3eaa9738, 0xf5f24011, 0xbcd77ec4, 0x85a73b6b,
+	0x4ad928c5, 0xecb4ed9b, 0xdcd3f6db, 0x36d6d84f,
+	0xd8cb133d, 0x2d39532c, 0x91ee2de8, 0x14491683,
+	0xb0e26f29, 0x5c5682b2, 0x80857469, 0xb653ac26,
+	0x155ae473, 0x3863b75f, 0xa98d9ab7, 0xbdc48c34,
+	0xcafe0b31, 0x96a88983, 0x162dfdea, 0xa07e51cc,
+	0xa68baf93, 0x9ee818cc, 0x3765827b, 0x8aa10e4f
+};
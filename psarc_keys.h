@@ -0,0 +1,14 @@
+#ifndef PSARC_KEYS_H__
+#define PSARC_KEYS_H__
+
+#include "aes.h"
+
+
+// The expanded AES-256 keys of the TOC and of the pc and mac .sng files,
+// generated with Aes256 from the keys in aes_check.cpp (checked by
+// --aes-check), so that no key setup is left for run time.
+extern const uint32_t PsarcKeySchedule[Aes256::SCHEDULE_WORDS];
+extern const uint32_t SngKeyMacSchedule[Aes256::SCHEDULE_WORDS];
+extern const uint32_t SngKeyPCSchedule[Aes256::SCHEDULE_WORDS];
+
+#endif // PSARC_KEYS_H__
@@ -0,0 +1,95 @@
+#include "psarc_toc.h"
+
+
+const uint32_t Toc::NO_NAME;
+const uint32_t Toc::NO_ENTRY;
+
+
+static uint32_t hashName(const char *name, uint32_t length) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+
+void Toc::resize(uint32_t numEntries) {
+	m_zIndex.assign(numEntries, 0);
+	m_length.assign(numEntries, 0);
+	m_zOffset.assign(numEntries, 0);
+	m_md5.assign((uint64_t)numEntries * MD5_SIZE, 0);
+	m_names.clear();
+	m_nameOffset.assign(numEntries, NO_NAME);
+	m_nameLength.assign(numEntries, 0);
+	m_nameTable.clear();
+}
+
+
+void Toc::parseNames(const uint8_t *manifest, uint64_t length) {
+	// The arena is the manifest with its line feeds turned into NULs
+	m_names.assign(manifest, manifest + length);
+	m_names.push_back('\0');
+	m_nameOffset.assign(size(), NO_NAME);
+	m_nameLength.assign(size(), 0);
+
+	uint64_t offset = 0;
+	for (uint32_t i = 1; i < size() && offset < length; i++) {
+		const char *start = &m_names[offset];
+		const char *end = (const char *)memchr(start, '\n', length - offset);
+		uint32_t nameLength = (end != NULL) ? end - start : length - offset;
+		m_names[offset + nameLength] = '\0';
+		m_nameOffset[i] = offset;
+		m_nameLength[i] = nameLength;
+		offset += nameLength + 1;
+	}
+	buildNameTable();
+}
+
+
+void Toc::setNames(const char *names, uint64_t namesSize, const uint32_t *nameOffsets) {
+	m_names.assign(names, names + namesSize);
+	for (uint32_t i = 0; i < size(); i++) {
+		m_nameOffset[i] = nameOffsets[i];
+		m_nameLength[i] = (nameOffsets[i] == NO_NAME) ? 0 : strlen(&m_names[nameOffsets[i]]);
+	}
+	buildNameTable();
+}
+
+
+void Toc::buildNameTable() {
+	uint32_t tableSize = 16;
+	while (tableSize < size() * 2) {
+		tableSize <<= 1;
+	}
+	m_nameTable.assign(tableSize, NO_ENTRY);
+
+	for (uint32_t i = 0; i < size(); i++) {
+		if (m_nameOffset[i] == NO_NAME) {
+			continue;
+		}
+		uint32_t slot = hashName(getName(i), m_nameLength[i]) & (tableSize - 1);
+		// A later entry with the same name replaces the earlier one
+		while (m_nameTable[slot] != NO_ENTRY && strcmp(getName(m_nameTable[slot]), getName(i)) != 0) {
+			slot = (slot + 1) & (tableSize - 1);
+		}
+		m_nameTable[slot] = i;
+	}
+}
+
+
+uint32_t Toc::find(const char *name) const {
+	if (m_nameTable.empty()) {
+		return NO_ENTRY;
+	}
+	uint32_t length = strlen(name);
+	uint32_t mask = m_nameTable.size() - 1;
+	for (uint32_t slot = hashName(name, length) & mask; m_nameTable[slot] != NO_ENTRY; slot = (slot + 1) & mask) {
+		uint32_t id = m_nameTable[slot];
+		if (m_nameLength[id] == length && memcmp(getName(id), name, length) == 0) {
+			return id;
+		}
+	}
+	return NO_ENTRY;
+}
@@ -0,0 +1,62 @@
+#ifndef PSARC_TOC_H__
+#define PSARC_TOC_H__
+
+#include <vector>
+#include "sys.h"
+
+
+// The TOC fields of all entries, kept in parallel arrays so that scans
+// over many entries only touch the fields they use. The names share one
+// arena of NUL terminated strings and are looked up through an open
+// addressing hash table of entry ids.
+class Toc {
+public:
+  static const uint32_t NO_NAME = 0xffffffff;
+  static const uint32_t NO_ENTRY = 0xffffffff;
+  static const uint32_t MD5_SIZE = 16;
+
+  void resize(uint32_t numEntries);
+  uint32_t size() const { return m_zIndex.size(); }
+
+  uint32_t getZIndex(uint32_t id) const { return m_zIndex[id]; }
+  void setZIndex(uint32_t id, uint32_t zIndex) { m_zIndex[id] = zIndex; }
+
+  uint64_t getLength(uint32_t id) const { return m_length[id]; }
+  void setLength(uint32_t id, uint64_t length) { m_length[id] = length; }
+
+  uint64_t getZOffset(uint32_t id) const { return m_zOffset[id]; }
+  void setZOffset(uint32_t id, uint64_t zOffset) { m_zOffset[id] = zOffset; }
+
+  const char *getMd5(uint32_t id) const { return &m_md5[(uint64_t)id * MD5_SIZE]; }
+  void setMd5(uint32_t id, const char *md5) { memcpy(&m_md5[(uint64_t)id * MD5_SIZE], md5, MD5_SIZE); }
+
+  const char *getName(uint32_t id) const {
+    return (m_nameOffset[id] == NO_NAME) ? NULL : &m_names[m_nameOffset[id]];
+  }
+  uint32_t getNameLength(uint32_t id) const { return m_nameLength[id]; }
+
+  // Takes the names of entries 1..n from the manifest, one per line.
+  void parseNames(const uint8_t *manifest, uint64_t length);
+  // Takes the names from an arena of NUL terminated strings, nameOffsets
+  // holds the offset of the name of each entry or NO_NAME.
+  void setNames(const char *names, uint64_t namesSize, const uint32_t *nameOffsets);
+  const std::vector<char>& getNames() const { return m_names; }
+  uint32_t getNameOffset(uint32_t id) const { return m_nameOffset[id]; }
+
+  // Returns the id of the entry called name, or NO_ENTRY.
+  uint32_t find(const char *name) const;
+
+private:
+  void buildNameTable();
+
+  std::vector<uint32_t> m_zIndex;
+  std::vector<uint64_t> m_length;
+  std::vector<uint64_t> m_zOffset;
+  std::vector<char> m_md5;
+  std::vector<char> m_names;
+  std::vector<uint32_t> m_nameOffset;
+  std::vector<uint32_t> m_nameLength;
+  std::vector<uint32_t> m_nameTable;
+};
+
+#endif // PSARC_TOC_H__
@@ -0,0 +1,130 @@
+#include <exception>
+#include "options.h"
+#include "psarc.h"
+#include "rscli.h"
+
+
+struct rscli_archive {
+  rscli_archive(const Options& options, rscli_log log, void *opaque)
+    : psarc(options), log(log), opaque(opaque) {}
+
+  PSARC psarc;
+  rscli_log log;
+  void *opaque;
+};
+
+
+// Nothing may be thrown through the C interface: called from a catch
+// block, reports the exception being handled instead.
+static void reportException(rscli_log log, void *opaque) {
+	if (log == NULL) {
+		return;
+	}
+	try {
+		throw;
+	} catch (const std::exception& e) {
+		log(opaque, e.what());
+	} catch (...) {
+		log(opaque, "unknown error");
+	}
+}
+
+
+rscli_archive *rscli_open(const char *path, rscli_log log, void *opaque) {
+	rscli_archive *archive = NULL;
+	try {
+		Options options;
+		// Entries are read block by block on the calling thread
+		options.threads = 1;
+		archive = new rscli_archive(options, log, opaque);
+		if (log != NULL) {
+			archive->psarc.setErrorHandler([log, opaque](const char *message) {
+				log(opaque, message);
+			});
+		} else {
+			archive->psarc.setErrorHandler([](const char *) {});
+		}
+		if (!archive->psarc.read(path)) {
+			delete archive;
+			archive = NULL;
+		}
+	} catch (...) {
+		reportException(log, opaque);
+		delete archive;
+		archive = NULL;
+	}
+	return archive;
+}
+
+void rscli_close(rscli_archive *archive) {
+	delete archive;
+}
+
+
+uint32_t rscli_entry_count(const rscli_archive *archive) {
+	return archive->psarc.getToc().size();
+}
+
+const char *rscli_entry_name(const rscli_archive *archive, uint32_t id) {
+	const Toc& toc = archive->psarc.getToc();
+	return (id < toc.size()) ? toc.getName(id) : NULL;
+}
+
+uint64_t rscli_entry_length(const rscli_archive *archive, uint32_t id) {
+	const Toc& toc = archive->psarc.getToc();
+	return (id < toc.size()) ? toc.getLength(id) : 0;
+}
+
+uint32_t rscli_find_entry(const rscli_archive *archive, const char *name) {
+	uint32_t id = archive->psarc.getToc().find(name);
+	return (id == Toc::NO_ENTRY) ? RSCLI_NO_ENTRY : id;
+}
+
+
+int64_t rscli_stream_entry(const rscli_archive *archive, uint32_t id, rscli_sink sink, void *opaque) {
+	if (id >= archive->psarc.getToc().size()) {
+		return RSCLI_ERROR_INVALID_ENTRY;
+	}
+	try {
+		const Entry& entry = archive->psarc.getEntry(id);
+		bool aborted = false;
+		uint64_t written = archive->psarc.streamEntry(entry, [sink, opaque, &aborted](const uint8_t *data, uint64_t length) {
+			aborted = sink(opaque, data, length) != 0;
+			return !aborted;
+		});
+		if (aborted) {
+			return RSCLI_ERROR_ABORTED;
+		}
+		return (written == entry.getLength()) ? (int64_t)written : RSCLI_ERROR_READ;
+	} catch (...) {
+		reportException(archive->log, archive->opaque);
+		return RSCLI_ERROR_READ;
+	}
+}
+
+int64_t rscli_read_entry(const rscli_archive *archive, uint32_t id, void *buffer, uint64_t size) {
+	if (id >= archive->psarc.getToc().size()) {
+		return RSCLI_ERROR_INVALID_ENTRY;
+	}
+	if (size < archive->psarc.getToc().getLength(id)) {
+		return RSCLI_ERROR_BUFFER_TOO_SMALL;
+	}
+	try {
+		uint8_t *out = (uint8_t *)buffer;
+		uint64_t left = size;
+		uint64_t written = archive->psarc.streamEntry(archive->psarc.getEntry(id), [&out, &left](const uint8_t *data, uint64_t length) {
+			// Never trust the blocks to add up to the length of the entry
+			if (length > left) {
+				return false;
+			}
+			memcpy(out, data, length);
+			out += length;
+			left -= length;
+			return true;
+		});
+		return (written == archive->psarc.getToc().getLength(id)) ? (int64_t)written : RSCLI_ERROR_READ;
+	} catch (...) {
+		reportException(archive->log, archive->opaque);
+		return RSCLI_ERROR_READ;
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef RSCLI_H__
+#define RSCLI_H__
+
+/*
+ * C interface of librscli, for embedding the archive reader in other
+ * programs. All state lives in the rscli_archive handles: handles are
+ * independent of each other, and the functions taking a const handle may
+ * be called from several threads at once.
+ *
+ * Entries are numbered as listed by rscli -l: ids 1 to count - 1 are the
+ * files, id 0 holds the list of names and has none. Entry data is returned
+ * as stored in the archive after decompression, .sng files stay encrypted.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define RSCLI_API __attribute__((visibility("default")))
+#else
+#define RSCLI_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RSCLI_NO_ENTRY 0xffffffffu
+
+/* Negative results of rscli_read_entry() and rscli_stream_entry() */
+#define RSCLI_ERROR_INVALID_ENTRY  -1
+#define RSCLI_ERROR_BUFFER_TOO_SMALL -2
+#define RSCLI_ERROR_READ           -3
+#define RSCLI_ERROR_ABORTED        -4
+
+typedef struct rscli_archive rscli_archive;
+
+/* Receives the data of an entry piece by piece, in order. Returns 0 to go
+   on, anything else stops the read with RSCLI_ERROR_ABORTED. */
+typedef int (*rscli_sink)(void *opaque, const void *data, size_t length);
+
+/* Receives the messages about damaged archives and failed reads, which the
+   library never prints. Called from the threads using the handle, so
+   possibly from several at once. */
+typedef void (*rscli_log)(void *opaque, const char *message);
+
+/* Opens the archive at path, returns NULL when it is not a readable PSARC.
+   Errors met with this handle go to log, or are dropped when it is NULL. */
+RSCLI_API rscli_archive *rscli_open(const char *path, rscli_log log, void *opaque);
+RSCLI_API void rscli_close(rscli_archive *archive);
+
+RSCLI_API uint32_t rscli_entry_count(const rscli_archive *archive);
+/* Name of entry id, NULL for id 0 or an invalid id. Valid until
+   rscli_close(). */
+RSCLI_API const char *rscli_entry_name(const rscli_archive *archive, uint32_t id);
+RSCLI_API uint64_t rscli_entry_length(const rscli_archive *archive, uint32_t id);
+/* Id of the entry called name, or RSCLI_NO_ENTRY. */
+RSCLI_API uint32_t rscli_find_entry(const rscli_archive *archive, const char *name);
+
+/* Reads entry id into buffer, returns its length or a negative
+   RSCLI_ERROR_ value. The buffer must hold rscli_entry_length() bytes. */
+RSCLI_API int64_t rscli_read_entry(const rscli_archive *archive, uint32_t id, void *buffer, uint64_t size);
+/* Passes entry id to sink one block at a time, so that only a block is
+   held in memory. Returns the length or a negative RSCLI_ERROR_ value. */
+RSCLI_API int64_t rscli_stream_entry(const rscli_archive *archive, uint32_t id, rscli_sink sink, void *opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RSCLI_H__
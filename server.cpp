@@ -0,0 +1,284 @@
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "server.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+Server::Server(const Options& options) : m_options(options) {
+	// Each client has its own thread already, a pool per cached archive
+	// would only sit idle
+	m_options.threads = 1;
+}
+
+
+static bool readAll(int fd, void *ptr, size_t size) {
+	uint8_t *p = (uint8_t *)ptr;
+	while (size > 0) {
+		ssize_t r = recv(fd, p, size, 0);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return false;
+		}
+		p += r;
+		size -= r;
+	}
+	return true;
+}
+
+
+// Sends a frame of type followed by length bytes of data with a single
+// sendmsg() when possible.
+static bool sendFrame(int fd, uint8_t type, const void *data, uint64_t length) {
+	uint8_t header[5];
+	WRITE_BE_UINT32(header, length + 1);
+	header[4] = type;
+
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = length;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = (length > 0) ? 2 : 1;
+
+	while (msg.msg_iovlen > 0) {
+		ssize_t w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			return false;
+		}
+		// Skip what was sent
+		while (msg.msg_iovlen > 0 && (size_t)w >= msg.msg_iov->iov_len) {
+			w -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + w;
+			msg.msg_iov->iov_len -= w;
+		}
+	}
+	return true;
+}
+
+static bool sendError(int fd, const char *message) {
+	return sendFrame(fd, Server::RESPONSE_ERROR, message, strlen(message));
+}
+
+
+// Returns the cached archive at path if it is unchanged on disk, and marks
+// it as the most recently used. A stale archive is dropped. Called with
+// m_mutex held.
+std::shared_ptr<PSARC> Server::findArchive(const std::string& path, uint64_t size, int64_t mtimeSec, int64_t mtimeNsec) {
+	std::unordered_map<std::string, Archive>::iterator it = m_archives.find(path);
+	if (it == m_archives.end()) {
+		return std::shared_ptr<PSARC>();
+	}
+	Archive& archive = it->second;
+	if (!archive.isCurrent(size, mtimeSec, mtimeNsec)) {
+		m_lru.erase(archive.lru);
+		m_archives.erase(it);
+		return std::shared_ptr<PSARC>();
+	}
+	m_lru.splice(m_lru.begin(), m_lru, archive.lru);
+	return archive.psarc;
+}
+
+
+// Returns the archive at path, opening it unless it is cached and still
+// unchanged on disk. The least recently used archive is closed when the
+// cache is full; requests still using it keep it alive until they finish.
+std::shared_ptr<PSARC> Server::getArchive(const std::string& path, const char **error) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		*error = "no such archive";
+		return std::shared_ptr<PSARC>();
+	}
+	uint64_t size = st.st_size;
+#ifdef __APPLE__
+	int64_t mtimeSec = st.st_mtimespec.tv_sec;
+	int64_t mtimeNsec = st.st_mtimespec.tv_nsec;
+#else
+	int64_t mtimeSec = st.st_mtim.tv_sec;
+	int64_t mtimeNsec = st.st_mtim.tv_nsec;
+#endif
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	std::shared_ptr<PSARC> psarc = findArchive(path, size, mtimeSec, mtimeNsec);
+	if (psarc) {
+		return psarc;
+	}
+	// Open without the lock, so that the clients of cached archives do not
+	// wait for the TOC to be read
+	lock.unlock();
+	psarc.reset(new PSARC(m_options, NULL, &m_bufferPool));
+	if (!psarc->read(path.c_str())) {
+		*error = "unable to open archive";
+		return std::shared_ptr<PSARC>();
+	}
+
+	lock.lock();
+	// Another client may have opened it meanwhile
+	std::shared_ptr<PSARC> cached = findArchive(path, size, mtimeSec, mtimeNsec);
+	if (cached) {
+		return cached;
+	}
+	if (m_archives.size() >= CACHE_SIZE) {
+		m_archives.erase(m_lru.back());
+		m_lru.pop_back();
+	}
+	m_lru.push_front(path);
+	Archive archive = { psarc, size, mtimeSec, mtimeNsec, m_lru.begin() };
+	m_archives[path] = archive;
+	return psarc;
+}
+
+
+// Returns false when the connection has to be closed.
+bool Server::handleRequest(int fd, const std::vector<char>& request) {
+	if (request.empty()) {
+		return sendError(fd, "empty request");
+	}
+	uint8_t op = request[0];
+	std::string path(request.begin() + 1, request.end());
+	std::string name;
+	size_t separator = path.find('\0');
+	if (separator != std::string::npos) {
+		name = path.substr(separator + 1);
+		path.resize(separator);
+	}
+
+	const char *error = NULL;
+	std::shared_ptr<PSARC> psarc = getArchive(path, &error);
+	if (!psarc) {
+		return sendError(fd, error);
+	}
+
+	if (op == REQUEST_LIST) {
+		const Toc& toc = psarc->getToc();
+		std::string list;
+		char line[64];
+		for (uint32_t i = 1; i < toc.size(); i++) {
+			snprintf(line, sizeof(line), "%d %" PRId64 " ", i, toc.getLength(i));
+			list += line;
+			if (toc.getName(i) != NULL) {
+				list.append(toc.getName(i), toc.getNameLength(i));
+			}
+			list += '\n';
+		}
+		return sendFrame(fd, RESPONSE_OK, list.data(), list.size());
+	}
+
+	if (op != REQUEST_STAT && op != REQUEST_EXTRACT) {
+		return sendError(fd, "unknown request");
+	}
+	Entry *entry = psarc->findEntry(name.c_str());
+	if (entry == NULL) {
+		return sendError(fd, "no such entry");
+	}
+	if (op == REQUEST_STAT) {
+		char line[64];
+		snprintf(line, sizeof(line), "%d %" PRId64 " %" PRId64 " ", entry->getId(), entry->getLength(), psarc->getCompressedLength(*entry));
+		std::string stat = line + name + "\n";
+		return sendFrame(fd, RESPONSE_OK, stat.data(), stat.size());
+	}
+
+	bool connected = true;
+	uint64_t written = psarc->streamEntry(*entry, [fd, &connected](const uint8_t *data, uint64_t length) {
+		connected = sendFrame(fd, RESPONSE_DATA, data, length);
+		return connected;
+	});
+	if (!connected) {
+		return false;
+	}
+	if (written != entry->getLength()) {
+		return sendError(fd, "unable to read entry");
+	}
+	return sendFrame(fd, RESPONSE_END, NULL, 0);
+}
+
+
+void Server::handleClient(int fd) {
+	std::vector<char> request;
+	uint8_t header[4];
+	while (readAll(fd, header, sizeof(header))) {
+		uint32_t length = READ_BE_UINT32(header);
+		if (length > MAX_REQUEST_SIZE) {
+			sendError(fd, "request too large");
+			break;
+		}
+		request.resize(length);
+		if (length > 0 && !readAll(fd, &request[0], length)) {
+			break;
+		}
+		if (!handleRequest(fd, request)) {
+			break;
+		}
+	}
+	::close(fd);
+}
+
+
+bool Server::serve(const char *socketPath) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		printf("Socket path '%s' is too long\n", socketPath);
+		return false;
+	}
+	strcpy(address.sun_path, socketPath);
+
+	// Replace the socket left by an earlier server, but nothing else
+	struct stat st;
+	if (lstat(socketPath, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			printf("Error: '%s' exists and is not a socket\n", socketPath);
+			return false;
+		}
+		unlink(socketPath);
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		printf("Unable to create socket: %s\n", strerror(errno));
+		return false;
+	}
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+		printf("Unable to listen on '%s': %s\n", socketPath, strerror(errno));
+		::close(listener);
+		return false;
+	}
+	// Clients going away are noticed through send() errors
+	signal(SIGPIPE, SIG_IGN);
+	printf("Serving on %s\n", socketPath);
+	fflush(stdout);
+
+	while (true) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			printf("Unable to accept connection: %s\n", strerror(errno));
+			break;
+		}
+		std::thread(&Server::handleClient, this, fd).detach();
+	}
+	::close(listener);
+	return false;
+}
@@ -0,0 +1,78 @@
+#ifndef SERVER_H__
+#define SERVER_H__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "buffer.h"
+#include "options.h"
+#include "psarc.h"
+
+
+// Answers list/stat/extract requests on a Unix domain socket, keeping the
+// most recently used archives open with their TOCs decoded.
+//
+// Requests and responses are frames: a 32-bit big-endian length followed
+// by that many bytes. A request is an opcode, the archive path and, for
+// STAT and EXTRACT, a NUL and the entry name:
+//   'L' archive               list the entries
+//   'S' archive \0 name       stat an entry
+//   'X' archive \0 name       extract an entry
+// A response is one or more frames starting with a type byte:
+//   'O' text                  LIST: "id length name\n" per entry,
+//                             STAT: "id length compressedLength name\n"
+//   'D' bytes                 next part of the data of an extracted entry
+//   'E'                       end of the data of an extracted entry
+//   '!' message               the request failed
+// A connection may send any number of requests, one after the other.
+class Server {
+public:
+  static const uint32_t CACHE_SIZE = 16;
+  static const uint32_t MAX_REQUEST_SIZE = 64 * 1024;
+
+  static const uint8_t REQUEST_LIST = 'L';
+  static const uint8_t REQUEST_STAT = 'S';
+  static const uint8_t REQUEST_EXTRACT = 'X';
+  static const uint8_t RESPONSE_OK = 'O';
+  static const uint8_t RESPONSE_DATA = 'D';
+  static const uint8_t RESPONSE_END = 'E';
+  static const uint8_t RESPONSE_ERROR = '!';
+
+  Server(const Options& options);
+
+  // Listens on socketPath and serves each client on its own thread.
+  // Only returns when the socket can not be set up.
+  bool serve(const char *socketPath);
+
+private:
+  struct Archive {
+    std::shared_ptr<PSARC> psarc;
+    uint64_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    std::list<std::string>::iterator lru;
+
+    bool isCurrent(uint64_t size, int64_t mtimeSec, int64_t mtimeNsec) const {
+      return this->size == size && this->mtimeSec == mtimeSec && this->mtimeNsec == mtimeNsec;
+    }
+  };
+
+  Server(const Server&);
+  Server& operator=(const Server&);
+
+  std::shared_ptr<PSARC> findArchive(const std::string& path, uint64_t size, int64_t mtimeSec, int64_t mtimeNsec);
+  std::shared_ptr<PSARC> getArchive(const std::string& path, const char **error);
+  void handleClient(int fd);
+  bool handleRequest(int fd, const std::vector<char>& request);
+
+  Options m_options;
+  BufferPool m_bufferPool;
+  std::mutex m_mutex;
+  std::list<std::string> m_lru;
+  std::unordered_map<std::string, Archive> m_archives;
+};
+
+#endif // SERVER_H__
@@ -0,0 +1,140 @@
+#include "thread_pool.h"
+
+
+// The pool and queue the calling thread works for, if it is a worker
+static thread_local const ThreadPool *t_pool = NULL;
+static thread_local uint32_t t_queueIndex = 0;
+
+
+ThreadPool::ThreadPool(uint32_t numThreads) : m_queued(0), m_stopping(false) {
+	if (numThreads < 1) {
+		numThreads = 1;
+	}
+	for (uint32_t i = 0; i < numThreads; i++) {
+		m_queues.push_back(std::unique_ptr<Queue>(new Queue));
+	}
+	for (uint32_t i = 1; i < numThreads; i++) {
+		m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_cond.notify_all();
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i].join();
+	}
+}
+
+
+uint32_t ThreadPool::getQueueIndex() const {
+	return (t_pool == this) ? t_queueIndex : 0;
+}
+
+
+void ThreadPool::run(TaskGroup& group, const std::function<void()>& task) {
+	group.pending++;
+	if (m_threads.empty()) {
+		// No workers, run it right away
+		task();
+		group.pending--;
+		return;
+	}
+	{
+		// Counted first so m_queued never drops below the number of queued
+		// tasks, under m_mutex so a thread about to sleep cannot miss it
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queued++;
+		group.queued++;
+	}
+	Queue& queue = *m_queues[getQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		Task t = { &group, task };
+		queue.tasks.push_back(t);
+	}
+	m_cond.notify_one();
+}
+
+
+// Takes a task from the back of the own queue, or else steals one from the
+// front of another queue. When group is not NULL only its tasks are taken.
+bool ThreadPool::takeTask(uint32_t index, Task& task, const TaskGroup *group) {
+	if (m_queued == 0 || (group != NULL && group->queued == 0)) {
+		return false;
+	}
+	for (uint32_t i = 0; i < m_queues.size(); i++) {
+		uint32_t victim = (index + i) % m_queues.size();
+		Queue& queue = *m_queues[victim];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+		std::deque<Task>::iterator it;
+		if (victim == index && index != 0) {
+			it = queue.tasks.end() - 1;
+			while (group != NULL && it->group != group && it != queue.tasks.begin()) {
+				--it;
+			}
+		} else {
+			it = queue.tasks.begin();
+			while (group != NULL && it->group != group && it + 1 != queue.tasks.end()) {
+				++it;
+			}
+		}
+		if (group != NULL && it->group != group) {
+			continue;
+		}
+		task = std::move(*it);
+		queue.tasks.erase(it);
+		m_queued--;
+		task.group->queued--;
+		return true;
+	}
+	return false;
+}
+
+
+void ThreadPool::runTask(Task& task) {
+	task.function();
+	if (--task.group->pending == 0) {
+		// Wake up the threads waiting for this group
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cond.notify_all();
+	}
+}
+
+
+void ThreadPool::wait(TaskGroup& group) {
+	uint32_t index = getQueueIndex();
+	while (group.pending > 0) {
+		Task task;
+		if (takeTask(index, task, &group)) {
+			runTask(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&group]() { return group.pending == 0 || group.queued > 0; });
+	}
+}
+
+
+void ThreadPool::workerLoop(uint32_t index) {
+	t_pool = this;
+	t_queueIndex = index;
+	while (true) {
+		Task task;
+		if (takeTask(index, task)) {
+			runTask(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this]() { return m_stopping || m_queued > 0; });
+		if (m_stopping) {
+			return;
+		}
+	}
+}
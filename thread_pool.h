@@ -0,0 +1,72 @@
+#ifndef THREAD_POOL_H__
+#define THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sys.h"
+
+
+// Tracks the tasks submitted together so that a caller can wait for them.
+class TaskGroup {
+public:
+  TaskGroup() : pending(0), queued(0) {}
+
+private:
+  friend class ThreadPool;
+  std::atomic<uint32_t> pending;
+  // Of which not taken by a thread yet
+  std::atomic<uint32_t> queued;
+};
+
+
+// Fixed size work-stealing pool of worker threads. Every worker has its
+// own deque: tasks submitted from a worker go to the back of its deque
+// and are taken back from there (newest first, while their data is still
+// in cache), idle threads steal the oldest tasks from the front of the
+// others' deques. Tasks submitted from other threads go to a shared deque.
+// A thread waiting for a TaskGroup runs the queued tasks of that group
+// itself, so tasks may submit and wait for tasks of their own, but it never
+// starts unrelated work in the middle of its own.
+class ThreadPool {
+public:
+  // numThreads includes the calling thread, numThreads - 1 workers are started.
+  ThreadPool(uint32_t numThreads);
+  ~ThreadPool();
+
+  uint32_t getNumThreads() const { return m_threads.size() + 1; }
+
+  void run(TaskGroup& group, const std::function<void()>& task);
+  void wait(TaskGroup& group);
+
+private:
+  struct Task {
+    TaskGroup *group;
+    std::function<void()> function;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerLoop(uint32_t index);
+  uint32_t getQueueIndex() const;
+  bool takeTask(uint32_t index, Task& task, const TaskGroup *group = NULL);
+  void runTask(Task& task);
+
+  // Queue 0 is shared, queue i belongs to worker i
+  std::vector<std::unique_ptr<Queue> > m_queues;
+  std::vector<std::thread> m_threads;
+  std::atomic<uint32_t> m_queued;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_stopping;
+};
+
+#endif // THREAD_POOL_H__